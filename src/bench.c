@@ -0,0 +1,566 @@
+// Benchmark for every parse path over synthetic command lines, with glibc's getopt_long as the baseline
+// Usage: KirbBench [csv|json] [seed] [max_argc]
+// Every run with the same seed parses the same command lines, so results can be compared between releases
+
+#include "kirbparse.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#if defined(__GLIBC__)
+    #include <getopt.h>
+#endif
+
+// Arguments parsed per measurement, short command lines are parsed repeatedly until they add up to this
+#define BENCH_ARGS_PER_RUN 2000000
+#define BENCH_MAX_OPTS 60
+
+// One synthetic command line shape
+struct workload
+{
+    const char *name;
+    int argc;
+    int num_opts;        // A quarter of these are value options, the rest flags
+    int short_pct;       // Chance of an argument being a short option
+    int long_pct;        // Chance of an argument being a long option, anything else is anonymous
+    int dup_pct;         // Chance of an option repeating one given earlier
+    int allow_crossover; // Without it only flags repeat, and always in the form they were first given
+};
+
+static const struct workload workloads[] = {
+    { "tiny",         10,      8,  40, 30, 0,  0 },
+    { "small",        100,     16, 30, 30, 5,  0 },
+    { "mixed_1k",     1000,    32, 25, 25, 10, 0 },
+    { "many_opts_1k", 1000,    60, 30, 30, 0,  0 },
+    { "short_10k",    10000,   32, 60, 0,  20, 0 },
+    { "long_10k",     10000,   32, 0,  60, 20, 0 },
+    { "anon_100k",    100000,  16, 2,  2,  0,  0 },
+    { "dups_100k",    100000,  60, 20, 20, 50, 1 },
+    { "huge_1m",      1000000, 32, 10, 10, 10, 1 },
+};
+
+// Kernels the compiled table paths are also timed under, so the default lookup is picked from data
+static const char *const kernels[] = { "scalar", "sse2", "avx2" };
+
+// Rules for a workload, options 0 to num_flags - 1 are flags and the rest value options
+struct rules
+{
+    int num_flags;
+    int num_value_opts;
+    char flags[BENCH_MAX_OPTS + 1];
+    char value_opts[BENCH_MAX_OPTS + 1];
+    char *flags_long[BENCH_MAX_OPTS];
+    char *value_opts_long[BENCH_MAX_OPTS];
+    char short_args[BENCH_MAX_OPTS][3];  // "-c"
+    char long_args[BENCH_MAX_OPTS][16];  // "--flag12"
+};
+
+// Timings of one parse path, in nanoseconds per parse (-1 where the path has no such phase)
+// parse is what the full parse spends on top of separate prep and mark phases, so only three phase paths have it
+struct result
+{
+    double prep;
+    double mark;
+    double parse;
+    double total;
+    double allocs; // Per parse, -1 if the path allocates outside the context's hooks
+    int status;
+};
+
+// File-scope helper functions
+static unsigned long long next_random(unsigned long long *state);
+static void make_rules(struct rules *rules, int num_opts);
+static char **make_argv(const struct workload *load, const struct rules *rules, unsigned long long *state);
+static double now_ns(void);
+static long peak_rss_kb(void);
+static void *count_alloc(size_t size, void *user);
+static void count_release(void *ptr, void *user);
+static struct result bench_reference(const struct workload *load, struct rules *rules, char **argv, int reps);
+static struct result bench_table(const struct workload *load, struct rules *rules, char **argv, int reps);
+static struct result bench_context(const struct workload *load, struct rules *rules, char **argv, int reps);
+static struct result bench_arena(const struct workload *load, struct rules *rules, char **argv, int reps);
+static struct result bench_getopt(const struct workload *load, struct rules *rules, char **argv, int reps);
+static void report(int json, int *first, const struct workload *load, const char *mode, struct result result);
+
+static const char *anon_pool[] = { "main.c", "util.c", "README.md", "build/out.o", "a", "input.txt", "x.y.z", "." };
+#if defined(__GLIBC__)
+// Where bench_getopt's outputs end up, so the compiler can't drop the loop that stores them
+static volatile unsigned long long getopt_checksum;
+#endif
+
+int main(int argc, char *argv[])
+{
+    int json = argc > 1 && strcmp(argv[1], "json") == 0;
+    unsigned long long seed = argc > 2 ? strtoull(argv[2], NULL, 10) : 1;
+    long max_argc = argc > 3 ? strtol(argv[3], NULL, 10) : 1000000;
+    int first = 1;
+
+    kirbparse_info = stderr; // Keep stdout clean for the report
+    kirbparse_err = stderr;
+    kirbparse_debug = 0;
+    kirbparse_werror = 0;
+
+    if(json)
+        printf("[\n");
+    else
+        printf("workload,argc,options,crossover,mode,status,prep_ns,mark_ns,parse_ns,total_ns,ns_per_arg,"
+               "allocs,peak_rss_kb\n");
+
+    for(size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]); ++w)
+    {
+        const struct workload *load = &workloads[w];
+        if(load->argc > max_argc)
+            continue;
+
+        struct rules rules;
+        unsigned long long state = seed * 0x9e3779b97f4a7c15ull + w + 1;
+        make_rules(&rules, load->num_opts);
+        char **load_argv = make_argv(load, &rules, &state);
+        if(load_argv == NULL)
+        {
+            fprintf(stderr, "out of memory for workload %s\n", load->name);
+            return 1;
+        }
+        int reps = BENCH_ARGS_PER_RUN / load->argc > 1 ? BENCH_ARGS_PER_RUN / load->argc : 1;
+
+        report(json, &first, load, "reference", bench_reference(load, &rules, load_argv, reps));
+        report(json, &first, load, "table", bench_table(load, &rules, load_argv, reps));
+        report(json, &first, load, "context", bench_context(load, &rules, load_argv, reps));
+        report(json, &first, load, "arena", bench_arena(load, &rules, load_argv, reps));
+        const char *picked = Kirb_simd_kernel();
+        for(size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); ++k)
+        {
+            if(Kirb_simd_use(kernels[k]) != 0)
+                continue;
+            char mode[32];
+            snprintf(mode, sizeof(mode), "table_%s", kernels[k]);
+            report(json, &first, load, mode, bench_table(load, &rules, load_argv, reps));
+            snprintf(mode, sizeof(mode), "context_%s", kernels[k]);
+            report(json, &first, load, mode, bench_context(load, &rules, load_argv, reps));
+        }
+        Kirb_simd_use(picked);
+#if defined(__GLIBC__)
+        report(json, &first, load, "getopt_long", bench_getopt(load, &rules, load_argv, reps));
+#endif
+        free(load_argv);
+    }
+
+    if(json)
+        printf("\n]\n");
+    return 0;
+}
+
+// xorshift64*, plenty for picking arguments and the same everywhere
+static unsigned long long next_random(unsigned long long *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545f4914f6cdd1dull;
+}
+
+static void make_rules(struct rules *rules, int num_opts)
+{
+    static const char short_pool[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+
+    rules->num_value_opts = num_opts / 4;
+    rules->num_flags = num_opts - rules->num_value_opts;
+    for(int k = 0; k < num_opts; ++k)
+    {
+        int value = k >= rules->num_flags;
+        snprintf(rules->short_args[k], sizeof(rules->short_args[k]), "-%c", short_pool[k]);
+        snprintf(rules->long_args[k], sizeof(rules->long_args[k]), "--%s%d", value ? "value" : "flag", k);
+        if(value)
+        {
+            rules->value_opts[k - rules->num_flags] = short_pool[k];
+            rules->value_opts_long[k - rules->num_flags] = rules->long_args[k] + 2;
+        }
+        else
+        {
+            rules->flags[k] = short_pool[k];
+            rules->flags_long[k] = rules->long_args[k] + 2;
+        }
+    }
+    rules->flags[rules->num_flags] = '\0';
+    rules->value_opts[rules->num_value_opts] = '\0';
+}
+
+// A command line that parses cleanly (status 0) under the workload's rules
+static char **make_argv(const struct workload *load, const struct rules *rules, unsigned long long *state)
+{
+    int num_opts = rules->num_flags + rules->num_value_opts;
+    int unused[BENCH_MAX_OPTS], num_unused = num_opts;
+    int given[BENCH_MAX_OPTS], num_given = 0; // Flags given so far, the only options that may repeat
+    char form[BENCH_MAX_OPTS] = { 0 };        // 's' or 'l' once an option has been given
+    char **argv = malloc(load->argc * sizeof(char*));
+    if(argv == NULL)
+        return NULL;
+
+    for(int k = 0; k < num_opts; ++k)
+        unused[k] = k;
+    argv[0] = "bench";
+    for(int i = 1; i < load->argc;)
+    {
+        int roll = (int) (next_random(state) % 100), k = -1;
+        if(roll < load->short_pct + load->long_pct)
+        {
+            if(num_given > 0 && (int) (next_random(state) % 100) < load->dup_pct)
+                k = given[next_random(state) % num_given];
+            else if(num_unused > 0)
+            {
+                int u = (int) (next_random(state) % num_unused);
+                k = unused[u];
+                unused[u] = unused[--num_unused];
+            }
+            else if(load->allow_crossover)
+                k = (int) (next_random(state) % num_opts);
+            else if(num_given > 0)
+                k = given[next_random(state) % num_given];
+        }
+        // A value option needs room for its value
+        if(k >= rules->num_flags && i + 1 >= load->argc)
+            k = -1;
+
+        if(k == -1)
+        {
+            argv[i++] = (char*) anon_pool[next_random(state) % (sizeof(anon_pool) / sizeof(anon_pool[0]))];
+            continue;
+        }
+        char want = roll < load->short_pct ? 's' : 'l';
+        if(form[k] == 0 && k < rules->num_flags)
+            given[num_given++] = k;
+        if(form[k] == 0 || load->allow_crossover)
+            form[k] = want;
+        argv[i++] = (char*) (form[k] == 's' ? rules->short_args[k] : rules->long_args[k]);
+        if(k >= rules->num_flags)
+            argv[i++] = "value";
+    }
+    return argv;
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Peak resident set of the whole process so far
+static long peak_rss_kb(void)
+{
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) != 0)
+        return -1;
+#if defined(__APPLE__)
+    return usage.ru_maxrss / 1024; // Bytes on macOS
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+static void *count_alloc(size_t size, void *user)
+{
+    ++*(long*) user;
+    return malloc(size);
+}
+
+static void count_release(void *ptr, void *user)
+{
+    (void) user;
+    free(ptr);
+}
+
+// The original three phases, straight from the rule lists
+static struct result bench_reference(const struct workload *load, struct rules *rules, char **argv, int reps)
+{
+    struct result result = { 0, 0, 0, 0, -1, 0 };
+    int flags_out[BENCH_MAX_OPTS], num_anon;
+    char *values_out[BENCH_MAX_OPTS];
+    uint8_t *marks = malloc(load->argc);
+    double start;
+
+    for(int r = 0; r < reps; ++r)
+    {
+        start = now_ns();
+        result.status |= Kirb_prep(load->argc, argv, rules->num_flags, rules->flags, rules->flags_long,
+                                   rules->num_value_opts, rules->value_opts, rules->value_opts_long,
+                                   0, load->allow_crossover);
+        result.prep += now_ns() - start;
+
+        start = now_ns();
+        Kirb_mark_compact(load->argc, argv, rules->num_value_opts, rules->value_opts, rules->value_opts_long, marks);
+        result.mark += now_ns() - start;
+
+        char **anon = NULL;
+        start = now_ns();
+        result.status |= Kirb_parse_all(load->argc, argv, rules->num_flags, rules->flags, rules->flags_long,
+                                        0, load->allow_crossover, rules->num_value_opts, rules->value_opts,
+                                        rules->value_opts_long, flags_out, values_out, &num_anon, &anon);
+        result.total += now_ns() - start;
+        Kirb_free_anon(NULL, anon);
+    }
+    free(marks);
+    result.prep /= reps;
+    result.mark /= reps;
+    result.total /= reps;
+    result.parse = result.total > result.prep + result.mark ? result.total - result.prep - result.mark : 0;
+    return result;
+}
+
+// Compiled rules, still three separate phases
+static struct result bench_table(const struct workload *load, struct rules *rules, char **argv, int reps)
+{
+    struct result result = { 0, 0, 0, 0, -1, 0 };
+    int flags_out[BENCH_MAX_OPTS], num_anon;
+    char *values_out[BENCH_MAX_OPTS];
+    enum Mark *marks = malloc(load->argc * sizeof(enum Mark));
+    KirbTable table;
+    double start;
+
+    if(marks == NULL || Kirb_compile(&table, rules->num_flags, rules->flags, rules->flags_long,
+                                     rules->num_value_opts, rules->value_opts, rules->value_opts_long, 0) != 0)
+    {
+        free(marks);
+        result.status = -1;
+        return result;
+    }
+    for(int r = 0; r < reps; ++r)
+    {
+        start = now_ns();
+        result.status |= Kirb_prep_table(load->argc, argv, &table, load->allow_crossover);
+        result.prep += now_ns() - start;
+
+        start = now_ns();
+        Kirb_mark_table(load->argc, argv, &table, marks);
+        result.mark += now_ns() - start;
+
+        char **anon = NULL;
+        start = now_ns();
+        result.status |= Kirb_parse_table(load->argc, argv, &table, load->allow_crossover,
+                                          flags_out, values_out, &num_anon, &anon);
+        result.total += now_ns() - start;
+        Kirb_free_anon(NULL, anon);
+    }
+    Kirb_free_table(&table);
+    free(marks);
+    result.prep /= reps;
+    result.mark /= reps;
+    result.total /= reps;
+    result.parse = result.total > result.prep + result.mark ? result.total - result.prep - result.mark : 0;
+    return result;
+}
+
+// A context, where Kirb_parse_all_ctx does everything in one pass
+static struct result bench_context(const struct workload *load, struct rules *rules, char **argv, int reps)
+{
+    struct result result = { 0, 0, -1, 0, 0, 0 };
+    int flags_out[BENCH_MAX_OPTS], num_anon;
+    char *values_out[BENCH_MAX_OPTS];
+    uint8_t *marks = malloc(load->argc);
+    long allocations = 0;
+    KirbContext ctx;
+    double start;
+
+    if(marks == NULL || Kirb_context_init(&ctx, stderr, stderr, rules->num_flags, rules->flags, rules->flags_long,
+                                          rules->num_value_opts, rules->value_opts, rules->value_opts_long,
+                                          0, load->allow_crossover) != 0)
+    {
+        free(marks);
+        result.status = -1;
+        return result;
+    }
+    ctx.alloc = count_alloc;
+    ctx.release = count_release;
+    ctx.alloc_user = &allocations;
+
+    for(int r = 0; r < reps; ++r)
+    {
+        start = now_ns();
+        result.status |= Kirb_prep_ctx(load->argc, argv, &ctx);
+        result.prep += now_ns() - start;
+
+        start = now_ns();
+        Kirb_mark_compact_ctx(load->argc, argv, &ctx, marks);
+        result.mark += now_ns() - start;
+
+        char **anon = NULL;
+        long before = allocations;
+        start = now_ns();
+        result.status |= Kirb_parse_all_ctx(load->argc, argv, &ctx, flags_out, values_out, &num_anon, &anon);
+        result.total += now_ns() - start;
+        result.allocs += allocations - before;
+        Kirb_free_anon(&ctx, anon);
+    }
+    Kirb_context_free(&ctx);
+    free(marks);
+    result.prep /= reps;
+    result.mark /= reps;
+    result.total /= reps;
+    result.allocs /= reps;
+    return result;
+}
+
+// A context parsing into a caller supplied arena, no phases to time separately
+static struct result bench_arena(const struct workload *load, struct rules *rules, char **argv, int reps)
+{
+    struct result result = { -1, -1, -1, 0, 0, 0 };
+    long allocations = 0;
+    KirbContext ctx;
+    KirbResult out;
+
+    if(Kirb_context_init(&ctx, stderr, stderr, rules->num_flags, rules->flags, rules->flags_long,
+                         rules->num_value_opts, rules->value_opts, rules->value_opts_long,
+                         0, load->allow_crossover) != 0)
+    {
+        result.status = -1;
+        return result;
+    }
+    ctx.alloc = count_alloc;
+    ctx.release = count_release;
+    ctx.alloc_user = &allocations;
+    size_t arena_size = Kirb_arena_size(load->argc, &ctx);
+    void *arena = malloc(arena_size);
+    if(arena == NULL)
+    {
+        Kirb_context_free(&ctx);
+        result.status = -1;
+        return result;
+    }
+
+    double start = now_ns();
+    for(int r = 0; r < reps; ++r)
+        result.status |= Kirb_parse_arena(load->argc, argv, &ctx, arena, arena_size, &out);
+    result.total = (now_ns() - start) / reps;
+    result.allocs = (double) allocations / reps;
+    free(arena);
+    Kirb_context_free(&ctx);
+    return result;
+}
+
+#if defined(__GLIBC__)
+// getopt_long over the same arguments, returning anonymous values in order like the other paths ("-" optstring)
+static struct result bench_getopt(const struct workload *load, struct rules *rules, char **argv, int reps)
+{
+    struct result result = { -1, -1, -1, 0, -1, 0 };
+    int num_opts = rules->num_flags + rules->num_value_opts;
+    struct option *longopts = calloc(num_opts + 1, sizeof(struct option));
+    char *optstring = malloc(2 * num_opts + 3);
+    char **args = malloc(load->argc * sizeof(char*));
+    int flags_out[BENCH_MAX_OPTS];
+    char *values_out[BENCH_MAX_OPTS];
+    unsigned long long checksum = 0;
+    double start;
+
+    if(longopts == NULL || optstring == NULL || args == NULL)
+    {
+        free(longopts);
+        free(optstring);
+        free(args);
+        result.status = -1;
+        return result;
+    }
+    int at = 0;
+    optstring[at++] = '-';
+    optstring[at++] = ':';
+    for(int k = 0; k < num_opts; ++k)
+    {
+        int value = k >= rules->num_flags;
+        longopts[k].name = rules->long_args[k] + 2;
+        longopts[k].has_arg = value ? required_argument : no_argument;
+        longopts[k].flag = NULL;
+        longopts[k].val = 256 + k;
+        optstring[at++] = rules->short_args[k][1];
+        if(value)
+            optstring[at++] = ':';
+    }
+    optstring[at] = '\0';
+
+    for(int r = 0; r < reps; ++r)
+    {
+        memcpy(args, argv, load->argc * sizeof(char*)); // getopt may reorder what it's given
+        int num_anon = 0, c;
+        start = now_ns();
+        memset(flags_out, 0, rules->num_flags * sizeof(int));
+        memset(values_out, 0, rules->num_value_opts * sizeof(char*));
+        optind = 0; // Make glibc start over
+        opterr = 0;
+        while((c = getopt_long(load->argc, args, optstring, longopts, NULL)) != -1)
+        {
+            int k = c >= 256 ? c - 256 : -1;
+            if(c == 1)
+                ++num_anon;
+            else if(c == '?' || c == ':')
+                result.status = 1;
+            else if(k == -1)
+                k = (int) (strchr(rules->flags, c) != NULL ? strchr(rules->flags, c) - rules->flags
+                                                           : rules->num_flags + (strchr(rules->value_opts, c) -
+                                                                                 rules->value_opts));
+            if(k >= rules->num_flags)
+                values_out[k - rules->num_flags] = optarg;
+            else if(k >= 0)
+                flags_out[k] = 1;
+        }
+        result.total += now_ns() - start;
+        checksum += num_anon;
+        for(int k = 0; k < rules->num_flags; ++k)
+            checksum += flags_out[k];
+        for(int k = 0; k < rules->num_value_opts; ++k)
+            checksum += values_out[k] != NULL;
+    }
+    getopt_checksum = checksum;
+    free(longopts);
+    free(optstring);
+    free(args);
+    result.total /= reps;
+    return result;
+}
+#endif
+
+static void report(int json, int *first, const struct workload *load, const char *mode, struct result result)
+{
+    double per_arg = result.total / load->argc;
+    long rss = peak_rss_kb();
+
+    if(json)
+    {
+        printf("%s  {\"workload\": \"%s\", \"argc\": %d, \"options\": %d, \"crossover\": %d, \"mode\": \"%s\", "
+               "\"status\": %d, ", *first ? "" : ",\n", load->name, load->argc, load->num_opts,
+               load->allow_crossover, mode, result.status);
+        if(result.prep >= 0)
+            printf("\"prep_ns\": %.1f, \"mark_ns\": %.1f, ", result.prep, result.mark);
+        else
+            printf("\"prep_ns\": null, \"mark_ns\": null, ");
+        if(result.parse >= 0)
+            printf("\"parse_ns\": %.1f, ", result.parse);
+        else
+            printf("\"parse_ns\": null, ");
+        printf("\"total_ns\": %.1f, \"ns_per_arg\": %.3f, ", result.total, per_arg);
+        if(result.allocs >= 0)
+            printf("\"allocs\": %.2f, ", result.allocs);
+        else
+            printf("\"allocs\": null, ");
+        printf("\"peak_rss_kb\": %ld}", rss);
+    }
+    else
+    {
+        printf("%s,%d,%d,%d,%s,%d,", load->name, load->argc, load->num_opts, load->allow_crossover, mode,
+               result.status);
+        if(result.prep >= 0)
+            printf("%.1f,%.1f,", result.prep, result.mark);
+        else
+            printf(",,");
+        if(result.parse >= 0)
+            printf("%.1f,", result.parse);
+        else
+            printf(",");
+        printf("%.1f,%.3f,", result.total, per_arg);
+        if(result.allocs >= 0)
+            printf("%.2f,", result.allocs);
+        else
+            printf(",");
+        printf("%ld\n", rss);
+    }
+    *first = 0;
+}
@@ -0,0 +1,670 @@
+// Differential fuzzer: random rules and command lines through the original three phase Kirb_parse_all, then
+//  through every faster path, which must give the same return code and the same outputs
+// Usage: KirbFuzz [iterations] [seed]
+// Prints each path's throughput as CSV and exits 1 at the first disagreement, printing the case. Built with
+//  KIRB_LIBFUZZER (see the KIRBPARSE_FUZZER CMake option) it's a libFuzzer target instead, aborting on a disagreement
+// Every case runs under each SIMD kernel the CPU has, and every few thousand cases its rules also mark a command
+//  line long enough to split over threads
+// Paths with rules of their own (Kirb_parse_extended's syntax, subcommands, layering's other sources) are only
+//  compared where those rules don't come into it
+
+#include "kirbparse.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define FUZZ_MAX_OPTS 6
+#define FUZZ_MAX_ARGS 12
+// Bytes of input each standalone case is decoded from
+#define FUZZ_CASE_BYTES 64
+// Batch items per case, enough for every batch worker to have a queue of its own
+#define FUZZ_BATCH_ITEMS (2 * KIRB_BATCH_GRAIN + 1)
+#define FUZZ_BATCH_THREADS 3
+// Cases between the long command lines, which are more than two marking threads' worth
+#define FUZZ_LONG_EVERY 4096
+#define FUZZ_LONG_THREADS 4
+
+// File-scope types
+// One case: rules, and a command line to parse with them
+struct fuzz_case
+{
+    int num_flags;
+    int num_value_opts;
+    int allow_crossover;
+    int werror;
+    char flags[FUZZ_MAX_OPTS + 1];
+    char value_opts[FUZZ_MAX_OPTS + 1];
+    char *flags_long[FUZZ_MAX_OPTS];
+    char *value_opts_long[FUZZ_MAX_OPTS];
+    int argc;
+    char *argv[FUZZ_MAX_ARGS];
+    char text[(FUZZ_MAX_OPTS * 2 + FUZZ_MAX_ARGS) * 8]; // Generated names and arguments
+    size_t text_used;
+};
+
+// Input bytes, read as zeroes once they run out
+struct reader
+{
+    const uint8_t *data;
+    size_t size;
+    size_t at;
+};
+
+// Outputs of one parse
+struct outputs
+{
+    int ret;
+    int flags[FUZZ_MAX_OPTS];
+    char *values[FUZZ_MAX_OPTS];
+    int num_anon;
+    char **anon;
+};
+
+// Paths checked against the reference, in the order they're reported
+enum mode
+{
+    MODE_REFERENCE, MODE_TABLE, MODE_FUSED, MODE_CONTEXT, MODE_ARENA, MODE_BLOB, MODE_BITS, MODE_TYPED, MODE_MULTI,
+    MODE_LAYERED, MODE_LAZY, MODE_STREAM, MODE_BATCH, MODE_MARK, MODE_MARK_PARALLEL, MODE_MARK_LONG, MODE_PREP, NUM_MODES
+};
+
+static const char *mode_names[NUM_MODES] = {
+    "reference", "table", "fused", "context", "arena", "blob", "bits", "typed", "multi", "layered", "lazy", "stream",
+    "batch", "mark", "mark_parallel", "mark_long", "prep"
+};
+
+// Time spent in each path and how often it ran
+struct mode_stat
+{
+    double ns;
+    long runs;
+};
+
+// Anonymous values a stream hands back
+struct streamed
+{
+    char *anon[FUZZ_MAX_ARGS];
+    int count;
+};
+
+// File-scope helper functions
+static void decode(struct fuzz_case *c, struct reader *reader);
+static unsigned int next_byte(struct reader *reader);
+static char *make_string(struct fuzz_case *c, struct reader *reader, const char *alphabet, unsigned int max_length);
+static int check_kernels(struct fuzz_case *c, unsigned long long seed);
+static int check_case(struct fuzz_case *c);
+static int check_long(struct fuzz_case *c, unsigned long long seed);
+static int same(const struct fuzz_case *c, const struct outputs *a, const struct outputs *b);
+static void on_anon(char *anon, int position, void *user);
+static double now_ns(void);
+static void print_case(const struct fuzz_case *c, const char *mode);
+static unsigned long long next_random(unsigned long long *state);
+
+static struct mode_stat stats[NUM_MODES];
+static FILE *sink;
+
+static const char *const name_pool[] = { "verbose", "help", "output", "o", "a", "alpha", "", "x", "-", "ab" };
+static const char *const arg_pool[] = {
+    "-v", "-h", "-o", "-a", "-x", "--verbose", "--help", "--output", "--alpha", "--o", "--a", "--x", "--", "-", "-vv",
+    "x", "y", "", "--output=1", "-ofile", "--verb", "---"
+};
+static const char shorts[] = "vhoax-"; // With '\0' as the seventh, no short form
+static const char *const kernels[] = { "scalar", "sse2", "avx2" };
+
+#if defined(KIRB_LIBFUZZER)
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    if(sink == NULL)
+    {
+        sink = tmpfile();
+        kirbparse_info = sink;
+        kirbparse_err = sink;
+        kirbparse_debug = 0;
+    }
+    struct reader reader = { data, size, 0 };
+    struct fuzz_case c;
+    decode(&c, &reader);
+    if(check_kernels(&c, size * 0x9e3779b97f4a7c15ull + 1) != 0)
+        abort();
+    return 0;
+}
+#else
+int main(int argc, char *argv[])
+{
+    long iterations = argc > 1 ? strtol(argv[1], NULL, 10) : 100000;
+    unsigned long long seed = argc > 2 ? strtoull(argv[2], NULL, 10) : 1;
+    unsigned long long state = seed * 0x9e3779b97f4a7c15ull + 1;
+
+    // The parses only print when debug is on, which it never is, but the reference checks there's somewhere to
+    sink = tmpfile();
+    kirbparse_info = sink != NULL ? sink : stderr;
+    kirbparse_err = kirbparse_info;
+    kirbparse_debug = 0;
+
+    for(long i = 0; i < iterations; ++i)
+    {
+        uint8_t bytes[FUZZ_CASE_BYTES];
+        for(int b = 0; b < FUZZ_CASE_BYTES; b += 8)
+        {
+            unsigned long long word = next_random(&state);
+            memcpy(bytes + b, &word, 8);
+        }
+        struct reader reader = { bytes, sizeof(bytes), 0 };
+        struct fuzz_case c;
+        decode(&c, &reader);
+        if(check_kernels(&c, next_random(&state) | 1) != 0)
+        {
+            fprintf(stderr, "at iteration %ld with seed %llu\n", i, seed);
+            return 1;
+        }
+    }
+
+    printf("mode,runs,ns_per_parse,parses_per_sec\n");
+    for(int m = 0; m < NUM_MODES; ++m)
+    {
+        double per = stats[m].runs > 0 ? stats[m].ns / stats[m].runs : 0;
+        printf("%s,%ld,%.1f,%.0f\n", mode_names[m], stats[m].runs, per, per > 0 ? 1e9 / per : 0);
+    }
+    printf("# %ld cases agree under the", iterations);
+    for(size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); ++k)
+    {
+        if(Kirb_simd_use(kernels[k]) == 0)
+            printf(" %s", kernels[k]);
+    }
+    printf(" kernels\n");
+    return 0;
+}
+#endif
+
+// Rules and a command line from the input. Names and arguments mostly come from small pools, so rules collide
+//  and arguments match them, otherwise they're spelt out of a few characters
+static void decode(struct fuzz_case *c, struct reader *reader)
+{
+    c->text_used = 0;
+    c->num_flags = (int) (next_byte(reader) % (FUZZ_MAX_OPTS + 1));
+    c->num_value_opts = (int) (next_byte(reader) % (FUZZ_MAX_OPTS + 1));
+    unsigned int settings = next_byte(reader);
+    c->allow_crossover = settings & 1;
+    c->werror = settings >> 1 & 1;
+
+    for(int i = 0; i < c->num_flags + c->num_value_opts; ++i)
+    {
+        unsigned int pick = next_byte(reader);
+        char *name = pick < 224 ? (char*) name_pool[pick % (sizeof(name_pool) / sizeof(name_pool[0]))]
+                                : make_string(c, reader, "vhoax-", 3);
+        char opt = shorts[next_byte(reader) % (sizeof(shorts))];
+        if(i < c->num_flags)
+        {
+            c->flags_long[i] = name;
+            c->flags[i] = opt;
+        }
+        else
+        {
+            c->value_opts_long[i - c->num_flags] = name;
+            c->value_opts[i - c->num_flags] = opt;
+        }
+    }
+    c->flags[c->num_flags] = '\0';
+    c->value_opts[c->num_value_opts] = '\0';
+
+    c->argc = 1 + (int) (next_byte(reader) % FUZZ_MAX_ARGS);
+    for(int i = 0; i < c->argc; ++i)
+    {
+        unsigned int pick = next_byte(reader);
+        c->argv[i] = pick < 224 ? (char*) arg_pool[pick % (sizeof(arg_pool) / sizeof(arg_pool[0]))]
+                                : make_string(c, reader, "-vhoax=", 5);
+    }
+}
+
+static unsigned int next_byte(struct reader *reader)
+{
+    return reader->at < reader->size ? reader->data[reader->at++] : 0;
+}
+
+static char *make_string(struct fuzz_case *c, struct reader *reader, const char *alphabet, unsigned int max_length)
+{
+    char *text = c->text + c->text_used;
+    unsigned int length = next_byte(reader) % (max_length + 1);
+    size_t size = strlen(alphabet);
+    for(unsigned int i = 0; i < length; ++i)
+        text[i] = alphabet[next_byte(reader) % size];
+    text[length] = '\0';
+    c->text_used += length + 1;
+    return text;
+}
+
+// check_case with each kernel in turn, and now and then check_long, 0 if they all agree
+static int check_kernels(struct fuzz_case *c, unsigned long long seed)
+{
+    static long cases;
+    const char *picked = Kirb_simd_kernel();
+    int failed = 0;
+    for(size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]) && !failed; ++k)
+    {
+        if(Kirb_simd_use(kernels[k]) != 0)
+            continue;
+        failed = check_case(c) != 0 || (cases % FUZZ_LONG_EVERY == 0 && check_long(c, seed) != 0);
+        if(failed)
+            fprintf(stderr, "  with the %s kernel\n", kernels[k]);
+    }
+    ++cases;
+    Kirb_simd_use(picked);
+    return failed;
+}
+
+// Every path against the reference, 0 if they all agree
+static int check_case(struct fuzz_case *c)
+{
+    int nf = c->num_flags, nv = c->num_value_opts, argc = c->argc;
+    char **argv = c->argv;
+    double start;
+    int failed = -1;
+
+    // Reference
+    kirbparse_werror = c->werror;
+    struct outputs ref = { 0 };
+    start = now_ns();
+    ref.ret = Kirb_parse_all(argc, argv, nf, c->flags, c->flags_long, 0, c->allow_crossover,
+                             nv, c->value_opts, c->value_opts_long, ref.flags, ref.values, &ref.num_anon, &ref.anon);
+    stats[MODE_REFERENCE].ns += now_ns() - start;
+    ++stats[MODE_REFERENCE].runs;
+
+    KirbContext ctx;
+    if(Kirb_context_init(&ctx, kirbparse_info, kirbparse_err, nf, c->flags, c->flags_long,
+                         nv, c->value_opts, c->value_opts_long, 0, c->allow_crossover) != 0)
+    {
+        print_case(c, "context_init");
+        Kirb_free_anon(NULL, ref.anon);
+        return 1;
+    }
+    ctx.werror = c->werror;
+    const KirbTable *table = &ctx.table;
+
+    // Compiled table, three phases and fused
+    {
+        struct outputs out = { 0 };
+        start = now_ns();
+        out.ret = Kirb_parse_table(argc, argv, table, c->allow_crossover, out.flags, out.values, &out.num_anon,
+                                   &out.anon);
+        stats[MODE_TABLE].ns += now_ns() - start;
+        ++stats[MODE_TABLE].runs;
+        if(!same(c, &ref, &out))
+            failed = MODE_TABLE;
+        Kirb_free_anon(NULL, out.anon);
+    }
+    if(failed == -1)
+    {
+        struct outputs out = { 0 };
+        start = now_ns();
+        out.ret = Kirb_parse_fused(argc, argv, table, c->allow_crossover, out.flags, out.values, &out.num_anon,
+                                   &out.anon);
+        stats[MODE_FUSED].ns += now_ns() - start;
+        ++stats[MODE_FUSED].runs;
+        if(!same(c, &ref, &out))
+            failed = MODE_FUSED;
+        Kirb_free_anon(NULL, out.anon);
+    }
+
+    // Context, whose lookups go through the vector kernels
+    if(failed == -1)
+    {
+        struct outputs out = { 0 };
+        start = now_ns();
+        out.ret = Kirb_parse_all_ctx(argc, argv, &ctx, out.flags, out.values, &out.num_anon, &out.anon);
+        stats[MODE_CONTEXT].ns += now_ns() - start;
+        ++stats[MODE_CONTEXT].runs;
+        if(!same(c, &ref, &out))
+            failed = MODE_CONTEXT;
+        Kirb_free_anon(&ctx, out.anon);
+    }
+    if(failed == -1)
+    {
+        _Alignas(16) static char arena[8192];
+        size_t arena_size = Kirb_arena_size(argc, &ctx);
+        KirbResult result;
+        struct outputs out = { 0 };
+        start = now_ns();
+        out.ret = arena_size <= sizeof(arena) ? Kirb_parse_arena(argc, argv, &ctx, arena, arena_size, &result) : -2;
+        stats[MODE_ARENA].ns += now_ns() - start;
+        ++stats[MODE_ARENA].runs;
+        if(out.ret == 0)
+        {
+            memcpy(out.flags, result.flags, nf * sizeof(int));
+            memcpy(out.values, result.values, nv * sizeof(char*));
+            out.num_anon = result.num_anon;
+            out.anon = result.anon;
+        }
+        if(!same(c, &ref, &out))
+            failed = MODE_ARENA;
+    }
+
+    // The table saved as a blob and used from there
+    if(failed == -1)
+    {
+        _Alignas(8) static unsigned char blob[65536];
+        size_t blob_size = Kirb_table_blob_size(table);
+        KirbTable loaded;
+        struct outputs out = { 0 };
+        if(blob_size > sizeof(blob) || Kirb_save_table(table, blob, blob_size) != 0 ||
+           Kirb_load_table(&loaded, blob, blob_size) != 0)
+            failed = MODE_BLOB;
+        else
+        {
+            start = now_ns();
+            out.ret = Kirb_parse_table(argc, argv, &loaded, c->allow_crossover, out.flags, out.values, &out.num_anon,
+                                       &out.anon);
+            stats[MODE_BLOB].ns += now_ns() - start;
+            ++stats[MODE_BLOB].runs;
+            if(!same(c, &ref, &out))
+                failed = MODE_BLOB;
+            Kirb_free_anon(NULL, out.anon);
+            Kirb_free_table(&loaded);
+        }
+    }
+
+    // Other outputs of the same parse
+    if(failed == -1)
+    {
+        uint64_t bits[KIRB_FLAG_WORDS(FUZZ_MAX_OPTS)];
+        struct outputs out = { 0 };
+        start = now_ns();
+        out.ret = Kirb_parse_bits(argc, argv, &ctx, bits, out.values, &out.num_anon, &out.anon);
+        stats[MODE_BITS].ns += now_ns() - start;
+        ++stats[MODE_BITS].runs;
+        // A bit only says whether the flag was given, not how often
+        struct outputs given = ref;
+        for(int i = 0; i < nf; ++i)
+        {
+            given.flags[i] = ref.flags[i] != 0;
+            out.flags[i] = (int) (bits[i >> 6] >> (i & 63) & 1);
+        }
+        if(!same(c, &given, &out))
+            failed = MODE_BITS;
+        Kirb_free_anon(&ctx, out.anon);
+    }
+    if(failed == -1)
+    {
+        KirbType types[FUZZ_MAX_OPTS + 1];
+        KirbTyped typed[FUZZ_MAX_OPTS + 1];
+        for(int v = 0; v < nv; ++v)
+        {
+            types[v].kind = KIRB_STRING;
+            types[v].choices = NULL;
+            types[v].num_choices = 0;
+        }
+        struct outputs out = { 0 };
+        start = now_ns();
+        out.ret = Kirb_parse_typed(argc, argv, &ctx, types, out.flags, typed, &out.num_anon, &out.anon);
+        stats[MODE_TYPED].ns += now_ns() - start;
+        ++stats[MODE_TYPED].runs;
+        for(int v = 0; v < nv; ++v)
+            out.values[v] = (char*) typed[v].text;
+        if(!same(c, &ref, &out))
+            failed = MODE_TYPED;
+        Kirb_free_anon(&ctx, out.anon);
+    }
+    if(failed == -1)
+    {
+        // Repeating a value option is fine here, so all that's certain is a command line the reference takes is
+        //  taken too, with the same last value for each option
+        int max_values[FUZZ_MAX_OPTS + 1], offsets[FUZZ_MAX_OPTS + 1], indices[FUZZ_MAX_OPTS * FUZZ_MAX_ARGS + 1];
+        for(int v = 0; v < nv; ++v)
+            max_values[v] = FUZZ_MAX_ARGS;
+        struct outputs out = { 0 };
+        start = now_ns();
+        out.ret = Kirb_parse_multi(argc, argv, &ctx, max_values, NULL, out.flags, offsets, indices, &out.num_anon,
+                                   &out.anon);
+        stats[MODE_MULTI].ns += now_ns() - start;
+        ++stats[MODE_MULTI].runs;
+        if(ref.ret == 0)
+        {
+            for(int v = 0; v < nv && out.ret == 0; ++v)
+                out.values[v] = offsets[v + 1] > offsets[v] ? argv[indices[offsets[v + 1] - 1]] : NULL;
+            if(!same(c, &ref, &out))
+                failed = MODE_MULTI;
+        }
+        Kirb_free_anon(&ctx, out.anon);
+    }
+    if(failed == -1)
+    {
+        // No defaults, file or environment, so there's only argv to layer
+        KirbLayers *layers = Kirb_layers_create(&ctx, NULL, NULL, NULL, NULL, 0);
+        struct outputs out = { 0 };
+        start = now_ns();
+        out.ret = layers != NULL ? Kirb_parse_layered(argc, argv, layers, out.flags, out.values, NULL, NULL,
+                                                      &out.num_anon, &out.anon) : -1;
+        stats[MODE_LAYERED].ns += now_ns() - start;
+        ++stats[MODE_LAYERED].runs;
+        if(!same(c, &ref, &out))
+            failed = MODE_LAYERED;
+        Kirb_free_anon(&ctx, out.anon);
+        Kirb_layers_free(layers);
+    }
+
+    // Lazy, asking for everything and then finishing
+    if(failed == -1)
+    {
+        struct outputs out = { 0 };
+        char *anon[FUZZ_MAX_ARGS], *next;
+        int partial = 0, finished;
+        start = now_ns();
+        KirbLazy *lazy = Kirb_open(argc, argv, &ctx);
+        for(int i = 0; i < nf; ++i)
+            partial |= Kirb_get_flag(lazy, i, &out.flags[i]);
+        for(int i = 0; i < nv; ++i)
+            partial |= Kirb_get_value(lazy, i, &out.values[i]);
+        int got;
+        while((got = Kirb_next_anon(lazy, &next)) == 0 && next != NULL && out.num_anon < FUZZ_MAX_ARGS)
+            anon[out.num_anon++] = next;
+        partial |= got;
+        finished = Kirb_finish(lazy);
+        Kirb_close(lazy);
+        stats[MODE_LAZY].ns += now_ns() - start;
+        ++stats[MODE_LAZY].runs;
+        // Answers given before the end can't see problems further on, so on an error only the final verdict counts
+        out.ret = finished;
+        out.anon = anon;
+        if(finished != ref.ret || (ref.ret == 0 && (partial != 0 || !same(c, &ref, &out))))
+            failed = MODE_LAZY;
+    }
+
+    // Stream, fed a few arguments at a time
+    if(failed == -1)
+    {
+        struct outputs out = { 0 };
+        struct streamed streamed = { { 0 }, 0 };
+        int pushed = 0, at = 0, step = 1;
+        start = now_ns();
+        KirbStream *stream = Kirb_stream_open(&ctx, out.flags, out.values, on_anon, &streamed);
+        while(at < argc)
+        {
+            int count = at + step > argc ? argc - at : step;
+            pushed |= Kirb_stream_push(stream, count, argv + at);
+            at += count;
+            step = step % 3 + 1;
+        }
+        int ended = Kirb_stream_end(stream);
+        Kirb_stream_close(stream);
+        stats[MODE_STREAM].ns += now_ns() - start;
+        ++stats[MODE_STREAM].runs;
+        out.num_anon = streamed.count;
+        out.anon = streamed.anon;
+        // A stream can't take back what it's already handed on, so only success has to match exactly
+        if((ref.ret == 0) != (ended == 0) || (pushed && ended == 0) || (ref.ret == 0 && !same(c, &ref, &out)))
+            failed = MODE_STREAM;
+    }
+
+    // Batch, the same command line as enough items for every worker to take some
+    if(failed == -1)
+    {
+        KirbBatchItem items[FUZZ_BATCH_ITEMS];
+        int flags[FUZZ_BATCH_ITEMS * FUZZ_MAX_OPTS + 1], num_anon[FUZZ_BATCH_ITEMS], rets[FUZZ_BATCH_ITEMS];
+        char *values[FUZZ_BATCH_ITEMS * FUZZ_MAX_OPTS + 1], **anon[FUZZ_BATCH_ITEMS];
+        for(int i = 0; i < FUZZ_BATCH_ITEMS; ++i)
+        {
+            items[i].argc = argc;
+            items[i].argv = argv;
+            anon[i] = NULL;
+        }
+        start = now_ns();
+        int ret = Kirb_parse_batch(FUZZ_BATCH_ITEMS, items, &ctx, FUZZ_BATCH_THREADS, flags, values, num_anon, anon,
+                                   rets);
+        stats[MODE_BATCH].ns += now_ns() - start;
+        stats[MODE_BATCH].runs += FUZZ_BATCH_ITEMS;
+        for(int i = 0; i < FUZZ_BATCH_ITEMS; ++i)
+        {
+            struct outputs out = { rets[i], { 0 }, { NULL }, num_anon[i], anon[i] };
+            memcpy(out.flags, flags + i * nf, nf * sizeof(int));
+            memcpy(out.values, values + i * nv, nv * sizeof(char*));
+            if(ret != 0 || !same(c, &ref, &out))
+                failed = MODE_BATCH;
+            Kirb_free_anon(&ctx, anon[i]);
+        }
+    }
+
+    // Marks and prep on their own
+    if(failed == -1)
+    {
+        enum Mark reference[FUZZ_MAX_ARGS], marks[FUZZ_MAX_ARGS];
+        uint8_t compact[FUZZ_MAX_ARGS];
+        int expected = Kirb_mark(argc, argv, nv, c->value_opts, c->value_opts_long, reference);
+        start = now_ns();
+        int got = Kirb_mark_table(argc, argv, table, marks);
+        stats[MODE_MARK].ns += now_ns() - start;
+        ++stats[MODE_MARK].runs;
+        int agree = got == expected && memcmp(marks, reference, argc * sizeof(enum Mark)) == 0;
+        agree &= Kirb_mark_compact_ctx(argc, argv, &ctx, compact) == expected;
+        for(int i = 0; i < argc; ++i)
+            agree &= compact[i] == reference[i];
+        if(!agree)
+            failed = MODE_MARK;
+
+        start = now_ns();
+        got = Kirb_mark_parallel(argc, argv, &ctx, marks, 2);
+        stats[MODE_MARK_PARALLEL].ns += now_ns() - start;
+        ++stats[MODE_MARK_PARALLEL].runs;
+        if(failed == -1 && (got != expected || memcmp(marks, reference, argc * sizeof(enum Mark)) != 0))
+            failed = MODE_MARK_PARALLEL;
+    }
+    if(failed == -1)
+    {
+        int expected = Kirb_prep(argc, argv, nf, c->flags, c->flags_long, nv, c->value_opts, c->value_opts_long, 0,
+                                 c->allow_crossover);
+        start = now_ns();
+        int got = Kirb_prep_table(argc, argv, table, c->allow_crossover);
+        stats[MODE_PREP].ns += now_ns() - start;
+        ++stats[MODE_PREP].runs;
+        if(got != expected || Kirb_prep_ctx(argc, argv, &ctx) != expected)
+            failed = MODE_PREP;
+    }
+
+    if(failed != -1)
+        print_case(c, mode_names[failed]);
+    Kirb_free_anon(NULL, ref.anon);
+    Kirb_context_free(&ctx);
+    return failed != -1;
+}
+
+// The case's rules over a generated command line of more than two marking threads' worth of arguments, Kirb_mark
+//  against both parallel markers. 0 if they agree
+static int check_long(struct fuzz_case *c, unsigned long long seed)
+{
+    unsigned long long state = seed;
+    int argc = 2 * KIRB_MARK_GRAIN + 2 + (int) (next_random(&state) % KIRB_MARK_GRAIN);
+    char **argv = malloc(argc * sizeof(char*));
+    enum Mark *reference = malloc(argc * sizeof(enum Mark)), *marks = malloc(argc * sizeof(enum Mark));
+    uint8_t *compact = malloc(argc);
+    KirbContext ctx;
+    if(argv == NULL || reference == NULL || marks == NULL || compact == NULL ||
+       Kirb_context_init(&ctx, kirbparse_info, kirbparse_err, c->num_flags, c->flags, c->flags_long,
+                         c->num_value_opts, c->value_opts, c->value_opts_long, 0, c->allow_crossover) != 0)
+    {
+        free(argv);
+        free(reference);
+        free(marks);
+        free(compact);
+        return 0; // Nothing to compare
+    }
+
+    // The case's own arguments mixed with the pool, so the chunk boundaries land anywhere
+    argv[0] = c->argv[0];
+    for(int i = 1; i < argc; ++i)
+    {
+        unsigned long long pick = next_random(&state);
+        argv[i] = pick & 1 ? c->argv[(pick >> 1) % c->argc]
+                           : (char*) arg_pool[(pick >> 1) % (sizeof(arg_pool) / sizeof(arg_pool[0]))];
+    }
+
+    int expected = Kirb_mark(argc, argv, c->num_value_opts, c->value_opts, c->value_opts_long, reference);
+    double start = now_ns();
+    int got = Kirb_mark_parallel(argc, argv, &ctx, marks, FUZZ_LONG_THREADS);
+    stats[MODE_MARK_LONG].ns += now_ns() - start;
+    ++stats[MODE_MARK_LONG].runs;
+    int agree = got == expected && memcmp(marks, reference, argc * sizeof(enum Mark)) == 0;
+    agree &= Kirb_mark_compact_parallel(argc, argv, &ctx, compact, FUZZ_LONG_THREADS) == expected;
+    for(int i = 0; i < argc && agree; ++i)
+        agree &= compact[i] == reference[i];
+    if(!agree)
+    {
+        print_case(c, mode_names[MODE_MARK_LONG]);
+        fprintf(stderr, "  over %d generated arguments from seed %llu\n", argc, seed);
+    }
+
+    Kirb_context_free(&ctx);
+    free(argv);
+    free(reference);
+    free(marks);
+    free(compact);
+    return !agree;
+}
+
+// Whether b matches the reference a: the same return code, and the same outputs if the parse succeeded
+static int same(const struct fuzz_case *c, const struct outputs *a, const struct outputs *b)
+{
+    if(a->ret != b->ret)
+        return 0;
+    if(a->ret != 0)
+        return 1;
+    return memcmp(a->flags, b->flags, c->num_flags * sizeof(int)) == 0 &&
+           memcmp(a->values, b->values, c->num_value_opts * sizeof(char*)) == 0 && a->num_anon == b->num_anon &&
+           (a->num_anon == 0 || memcmp(a->anon, b->anon, a->num_anon * sizeof(char*)) == 0);
+}
+
+static void on_anon(char *anon, int position, void *user)
+{
+    (void) position;
+    struct streamed *streamed = user;
+    if(streamed->count < FUZZ_MAX_ARGS)
+        streamed->anon[streamed->count++] = anon;
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void print_case(const struct fuzz_case *c, const char *mode)
+{
+    fprintf(stderr, "MISMATCH: %s disagrees with the reference\n  crossover %d, werror %d\n  flags:",
+            mode, c->allow_crossover, c->werror);
+    for(int i = 0; i < c->num_flags; ++i)
+        fprintf(stderr, " '%c'/\"%s\"", c->flags[i] != '\0' ? c->flags[i] : '0', c->flags_long[i]);
+    fprintf(stderr, "\n  value options:");
+    for(int i = 0; i < c->num_value_opts; ++i)
+        fprintf(stderr, " '%c'/\"%s\"", c->value_opts[i] != '\0' ? c->value_opts[i] : '0', c->value_opts_long[i]);
+    fprintf(stderr, "\n  argv:");
+    for(int i = 0; i < c->argc; ++i)
+        fprintf(stderr, " \"%s\"", c->argv[i]);
+    fprintf(stderr, "\n");
+}
+
+// xorshift64*, the same as KirbBench's
+static unsigned long long next_random(unsigned long long *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545f4914f6cdd1dull;
+}
@@ -0,0 +1,264 @@
+// kirbbatch.c
+// Parsing many command lines at once over a pool of worker threads, and marking one huge command line over several
+
+#include "kirbparse.h"
+#include "kirbparse_internal.h"
+#include <stdlib.h>
+
+#if !defined(_WIN32)
+    #include <pthread.h>
+    #include <stdatomic.h>
+    #include <unistd.h>
+#endif
+
+// File-scope types
+struct batch
+{
+    const KirbContext *ctx;
+    const KirbBatchItem *items;
+    int *flags_out;
+    char **values_out;
+    int *num_anon;
+    char ***anon_out;
+    int *rets;
+};
+
+#if !defined(_WIN32)
+// Each worker starts with an even share of the items, and once its own share runs out it takes from the others'
+struct queue
+{
+    atomic_int next;
+    int end;
+};
+
+struct worker
+{
+    pthread_t thread;
+    int id;
+    int num_workers;
+    struct queue *queues;
+    const struct batch *batch;
+};
+#endif
+
+// A stretch of argv marked by one thread. A mark only depends on the argument before it, which is only ever read,
+//  so chunks never have to agree on anything at their boundaries
+struct mark_chunk
+{
+#if !defined(_WIN32)
+    pthread_t thread;
+#endif
+    const KirbTable *table;
+    char **argv;
+    int first;
+    int last;
+    enum Mark *marks;       // One of marks and compact_marks is NULL
+    uint8_t *compact_marks;
+    int num_anon;
+};
+
+// File-scope helper functions
+static void parse_item(const struct batch *batch, int i);
+static int mark_parallel(int argc, char **argv, const KirbContext *ctx, enum Mark *marks, uint8_t *compact_marks,
+                         int num_threads);
+static void *mark_chunk(void *arg);
+#if !defined(_WIN32)
+static int take(struct queue *queue, int *first, int *last);
+static void *work(void *arg);
+#endif
+
+int Kirb_parse_batch(int num_items, const KirbBatchItem *items, const KirbContext *ctx, int num_threads,
+                     int *flags_out, char **values_out, int *num_anon, char ***anon_out, int *rets)
+{
+    if(ctx == NULL || num_items < 0 || (num_items > 0 && (items == NULL || num_anon == NULL ||
+                                                          anon_out == NULL || rets == NULL)))
+        return -1;
+
+    // Stats and traces only take one thread at a time
+    KirbContext shared = *ctx;
+    shared.stats = NULL;
+    shared.trace = NULL;
+    struct batch batch = { &shared, items, flags_out, values_out, num_anon, anon_out, rets };
+
+#if !defined(_WIN32)
+    if(num_threads <= 0)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = cpus > 0 ? (int) cpus : 1;
+    }
+    // No point in a worker that could never get a full grain
+    if(num_threads > (num_items + KIRB_BATCH_GRAIN - 1) / KIRB_BATCH_GRAIN)
+        num_threads = (num_items + KIRB_BATCH_GRAIN - 1) / KIRB_BATCH_GRAIN;
+
+    if(num_threads > 1)
+    {
+        struct queue queues[num_threads];
+        struct worker workers[num_threads];
+        for(int w = 0; w < num_threads; ++w)
+        {
+            atomic_init(&queues[w].next, (int) ((long long) num_items * w / num_threads));
+            queues[w].end = (int) ((long long) num_items * (w + 1) / num_threads);
+            workers[w].id = w;
+            workers[w].num_workers = num_threads;
+            workers[w].queues = queues;
+            workers[w].batch = &batch;
+        }
+
+        // The calling thread is worker 0 and every worker steals from every queue, so a failed pthread_create only
+        //  means less help
+        int started = 1;
+        for(int w = 1; w < num_threads; ++w)
+        {
+            if(pthread_create(&workers[w].thread, NULL, work, &workers[w]) != 0)
+                break;
+            ++started;
+        }
+        work(&workers[0]);
+        for(int w = 1; w < started; ++w)
+            pthread_join(workers[w].thread, NULL);
+        return 0;
+    }
+#else
+    (void) num_threads; // No worker pool on Windows yet, everything runs on the calling thread
+#endif
+
+    for(int i = 0; i < num_items; ++i)
+        parse_item(&batch, i);
+    return 0;
+}
+
+int Kirb_mark_parallel(int argc, char **argv, const KirbContext *ctx, enum Mark *marks, int num_threads)
+{
+    return mark_parallel(argc, argv, ctx, marks, NULL, num_threads);
+}
+
+int Kirb_mark_compact_parallel(int argc, char **argv, const KirbContext *ctx, uint8_t *marks, int num_threads)
+{
+    return mark_parallel(argc, argv, ctx, NULL, marks, num_threads);
+}
+
+static int mark_parallel(int argc, char **argv, const KirbContext *ctx, enum Mark *marks, uint8_t *compact_marks,
+                         int num_threads)
+{
+    if(ctx == NULL || ctx->table.block == NULL || argc < 1 || argv == NULL)
+        return -1;
+    if(marks == NULL && compact_marks == NULL)
+    {
+        if(ctx->debug)
+            kirb_event(ctx, EVENT_NO_MARKS, -1, NULL);
+        return -1;
+    }
+    if(marks != NULL)
+        marks[0] = PROGRAM;
+    else
+        compact_marks[0] = PROGRAM;
+
+#if !defined(_WIN32)
+    if(num_threads <= 0)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = cpus > 0 ? (int) cpus : 1;
+    }
+#else
+    num_threads = 1; // No threads on Windows yet
+#endif
+    if(num_threads > (argc - 1) / KIRB_MARK_GRAIN)
+        num_threads = (argc - 1) / KIRB_MARK_GRAIN > 0 ? (argc - 1) / KIRB_MARK_GRAIN : 1;
+
+    struct mark_chunk chunks[num_threads];
+    for(int c = 0; c < num_threads; ++c)
+    {
+        chunks[c].table = &ctx->table;
+        chunks[c].argv = argv;
+        chunks[c].first = 1 + (int) ((long long) (argc - 1) * c / num_threads);
+        chunks[c].last = 1 + (int) ((long long) (argc - 1) * (c + 1) / num_threads);
+        chunks[c].marks = marks;
+        chunks[c].compact_marks = compact_marks;
+    }
+
+    // The calling thread marks the first chunk, and any chunk whose thread couldn't be started
+    int started[num_threads];
+    started[0] = 0;
+#if !defined(_WIN32)
+    for(int c = 1; c < num_threads; ++c)
+        started[c] = pthread_create(&chunks[c].thread, NULL, mark_chunk, &chunks[c]) == 0;
+#endif
+    int num_anon = 0;
+    for(int c = 0; c < num_threads; ++c)
+    {
+        if(!started[c])
+            mark_chunk(&chunks[c]);
+    }
+    for(int c = 0; c < num_threads; ++c)
+    {
+#if !defined(_WIN32)
+        if(started[c])
+            pthread_join(chunks[c].thread, NULL);
+#endif
+        num_anon += chunks[c].num_anon;
+    }
+    return num_anon;
+}
+
+static void *mark_chunk(void *arg)
+{
+    struct mark_chunk *chunk = arg;
+    int num_anon = 0;
+
+    for(int i = chunk->first; i < chunk->last; ++i)
+    {
+        enum Mark mark = kirb_mark_one(chunk->table, chunk->argv, i);
+        if(chunk->marks != NULL)
+            chunk->marks[i] = mark;
+        else
+            chunk->compact_marks[i] = (uint8_t) mark;
+        num_anon += mark == ANONYMOUS;
+    }
+    chunk->num_anon = num_anon;
+    return NULL;
+}
+
+static void parse_item(const struct batch *batch, int i)
+{
+    const KirbTable *table = &batch->ctx->table;
+
+    batch->num_anon[i] = 0;
+    batch->anon_out[i] = NULL;
+    batch->rets[i] = Kirb_parse_all_ctx(batch->items[i].argc, batch->items[i].argv, batch->ctx,
+                                        batch->flags_out + (size_t) i * table->num_flags,
+                                        batch->values_out + (size_t) i * table->num_value_opts,
+                                        batch->num_anon + i, batch->anon_out + i);
+}
+
+#if !defined(_WIN32)
+// Claim the next grain of a queue, 0 once it's empty
+static int take(struct queue *queue, int *first, int *last)
+{
+    if(atomic_load_explicit(&queue->next, memory_order_relaxed) >= queue->end)
+        return 0;
+    int at = atomic_fetch_add_explicit(&queue->next, KIRB_BATCH_GRAIN, memory_order_relaxed);
+    if(at >= queue->end)
+        return 0;
+    *first = at;
+    *last = at + KIRB_BATCH_GRAIN < queue->end ? at + KIRB_BATCH_GRAIN : queue->end;
+    return 1;
+}
+
+static void *work(void *arg)
+{
+    struct worker *worker = arg;
+    int first, last;
+
+    // Own queue first, then steal from the others starting with the next worker over
+    for(int k = 0; k < worker->num_workers; ++k)
+    {
+        struct queue *queue = &worker->queues[(worker->id + k) % worker->num_workers];
+        while(take(queue, &first, &last))
+        {
+            for(int i = first; i < last; ++i)
+                parse_item(worker->batch, i);
+        }
+    }
+    return NULL;
+}
+#endif
@@ -0,0 +1,64 @@
+// kirbbits.c
+// Questions about several flags at once, asked of the bitsets Kirb_parse_bits fills in
+
+#include "kirbparse.h"
+#include <string.h>
+
+int Kirb_flag_mask(uint64_t *mask, int num_flags, const int *flags, int count)
+{
+    if(mask == NULL || num_flags < 0 || count < 0 || (count > 0 && flags == NULL))
+        return -1;
+    memset(mask, 0, KIRB_FLAG_WORDS(num_flags) * sizeof(uint64_t));
+    for(int i = 0; i < count; ++i)
+    {
+        if(flags[i] < 0 || flags[i] >= num_flags)
+            return -1;
+        mask[flags[i] >> 6] |= (uint64_t) 1 << (flags[i] & 63);
+    }
+    return 0;
+}
+
+int Kirb_flags_any(const uint64_t *bits, const uint64_t *mask, int num_flags)
+{
+    for(int w = 0; w < KIRB_FLAG_WORDS(num_flags); ++w)
+    {
+        if(bits[w] & mask[w])
+            return 1;
+    }
+    return 0;
+}
+
+int Kirb_flags_all(const uint64_t *bits, const uint64_t *mask, int num_flags)
+{
+    for(int w = 0; w < KIRB_FLAG_WORDS(num_flags); ++w)
+    {
+        if((bits[w] & mask[w]) != mask[w])
+            return 0;
+    }
+    return 1;
+}
+
+int Kirb_flags_none(const uint64_t *bits, const uint64_t *mask, int num_flags)
+{
+    return !Kirb_flags_any(bits, mask, num_flags);
+}
+
+int Kirb_flags_conflicts(const uint64_t *bits, const KirbContext *ctx, int *found)
+{
+    if(bits == NULL || ctx == NULL || ctx->num_conflicts < 0 || (ctx->num_conflicts > 0 && ctx->conflicts == NULL))
+        return -1;
+    int num_flags = ctx->table.num_flags, count = 0;
+    for(int p = 0; p < ctx->num_conflicts; ++p)
+    {
+        int a = ctx->conflicts[2 * p], b = ctx->conflicts[2 * p + 1];
+        if(a < 0 || a >= num_flags || b < 0 || b >= num_flags)
+            return -1;
+        if((bits[a >> 6] >> (a & 63) & 1) && (bits[b >> 6] >> (b & 63) & 1))
+        {
+            if(found != NULL)
+                found[count] = p;
+            ++count;
+        }
+    }
+    return count;
+}
@@ -0,0 +1,292 @@
+// kirbblob.c
+// Compiled tables saved as blobs, and used straight from a C array or a mapped file with no setup
+
+#include "kirbparse.h"
+#include "kirbparse_internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#if !defined(_WIN32)
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+// The block starts this far into a blob, which keeps it as aligned as the blob is
+#define KIRB_BLOB_HEADER 64
+
+// File-scope types
+// Start of every blob, followed by the table's block exactly as it is in memory
+struct blob_header
+{
+    char magic[8];          // "KIRBTBL" and a NUL
+    uint32_t version;       // KIRB_BLOB_VERSION
+    uint32_t layout;        // Sizes and byte order the block was written with, see blob_layout
+    int32_t num_flags;
+    int32_t num_value_opts;
+    int32_t num_slots;
+    int32_t names_size;
+    int32_t num_nodes;
+    uint32_t reserved;
+    uint64_t block_size;
+    uint64_t checksum;      // Of everything before it in the header, then the block
+};
+
+_Static_assert(sizeof(struct blob_header) <= KIRB_BLOB_HEADER, "blob header outgrew its space");
+
+// File-scope helper functions
+static uint32_t blob_layout(void);
+static uint64_t checksum(uint64_t hash, const unsigned char *data, size_t size);
+static uint64_t blob_checksum(const struct blob_header *header, const void *block);
+static int check_blob(KirbTable *table, const void *blob, size_t blob_size);
+
+static const char magic[8] = "KIRBTBL";
+
+size_t Kirb_table_blob_size(const KirbTable *table)
+{
+    if(table == NULL || table->block == NULL)
+        return 0;
+    return KIRB_BLOB_HEADER + table->block_size;
+}
+
+int Kirb_save_table(const KirbTable *table, void *blob, size_t blob_size)
+{
+    if(table == NULL || table->block == NULL || blob == NULL)
+        return -1;
+    if(blob_size < Kirb_table_blob_size(table))
+        return -2;
+
+    struct blob_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, magic, sizeof(magic));
+    header.version = KIRB_BLOB_VERSION;
+    header.layout = blob_layout();
+    header.num_flags = table->num_flags;
+    header.num_value_opts = table->num_value_opts;
+    header.num_slots = table->num_slots;
+    header.names_size = table->names_size;
+    header.num_nodes = table->num_nodes;
+    header.block_size = table->block_size;
+    header.checksum = blob_checksum(&header, table->block);
+
+    memset(blob, 0, KIRB_BLOB_HEADER);
+    memcpy(blob, &header, sizeof(header));
+    memcpy((char*) blob + KIRB_BLOB_HEADER, table->block, table->block_size);
+    return 0;
+}
+
+int Kirb_load_table(KirbTable *table, const void *blob, size_t blob_size)
+{
+    if(table == NULL || blob == NULL || (uintptr_t) blob % 8 != 0)
+        return -1;
+    if(check_blob(table, blob, blob_size) == -1)
+        return -1;
+    table->source = KIRB_SOURCE_BORROWED;
+    return 0;
+}
+
+int Kirb_write_table(const KirbTable *table, const char *path)
+{
+    size_t size = Kirb_table_blob_size(table);
+    if(size == 0 || path == NULL)
+        return -1;
+    void *blob = malloc(size);
+    if(blob == NULL)
+        return -1;
+    Kirb_save_table(table, blob, size);
+
+    FILE *file = fopen(path, "wb");
+    int ret = file != NULL && fwrite(blob, 1, size, file) == size ? 0 : -1;
+    if(file != NULL && fclose(file) != 0)
+        ret = -1;
+    free(blob);
+    return ret;
+}
+
+int Kirb_map_table(KirbTable *table, const char *path)
+{
+    if(table == NULL || path == NULL)
+        return -1;
+
+#if !defined(_WIN32)
+    int fd = open(path, O_RDONLY);
+    if(fd == -1)
+        return -1;
+    struct stat st;
+    if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < KIRB_BLOB_HEADER)
+    {
+        close(fd);
+        return -1;
+    }
+    size_t size = (size_t) st.st_size;
+    void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED)
+        return -1;
+    // Exactly one blob, so unmapping only needs the block size
+    if(check_blob(table, data, size) == -1 || KIRB_BLOB_HEADER + table->block_size != size)
+    {
+        munmap(data, size);
+        table->block = NULL;
+        return -1;
+    }
+    table->source = KIRB_SOURCE_MAPPED;
+    return 0;
+#else
+    // No mapping, so the file is read and its block copied out to where Kirb_free_table can free it
+    FILE *file = fopen(path, "rb");
+    if(file == NULL)
+        return -1;
+    long end = -1;
+    if(fseek(file, 0, SEEK_END) == 0)
+        end = ftell(file);
+    if(end < KIRB_BLOB_HEADER || fseek(file, 0, SEEK_SET) != 0)
+    {
+        fclose(file);
+        return -1;
+    }
+    size_t size = (size_t) end;
+    char *data = malloc(size);
+    if(data == NULL || fread(data, 1, size, file) != size)
+    {
+        free(data);
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+
+    void *block = NULL;
+    if(check_blob(table, data, size) == 0)
+        block = malloc(table->block_size);
+    if(block == NULL)
+    {
+        free(data);
+        table->block = NULL;
+        return -1;
+    }
+    memcpy(block, data + KIRB_BLOB_HEADER, table->block_size);
+    free(data);
+    table->block = block;
+    kirb_table_layout(table);
+    table->source = KIRB_SOURCE_COMPILED;
+    return 0;
+#endif
+}
+
+int Kirb_context_load(KirbContext *ctx, FILE *info, FILE *err, const void *blob, size_t blob_size,
+                      int allow_crossover)
+{
+    if(ctx == NULL)
+        return -1;
+    ctx->info = info;
+    ctx->err = err;
+    ctx->debug = 0;
+    ctx->werror = 0;
+    ctx->allow_crossover = allow_crossover;
+    ctx->alloc = NULL;
+    ctx->release = NULL;
+    ctx->alloc_user = NULL;
+    ctx->stats = NULL;
+    ctx->trace = NULL;
+    ctx->conflicts = NULL;
+    ctx->num_conflicts = 0;
+    return Kirb_load_table(&ctx->table, blob, blob_size);
+}
+
+void kirb_unmap_table(KirbTable *table)
+{
+#if !defined(_WIN32)
+    munmap((char*) table->block - KIRB_BLOB_HEADER, KIRB_BLOB_HEADER + table->block_size);
+#else
+    (void) table;
+#endif
+}
+
+// Blobs only work on machines that lay the block out the same way
+static uint32_t blob_layout(void)
+{
+    const uint16_t one = 1;
+    uint8_t little = *(const uint8_t*) &one;
+    return (uint32_t) sizeof(int) | (uint32_t) sizeof(struct KirbSlot) << 8 | (uint32_t) sizeof(struct KirbNode) << 16 |
+           (uint32_t) (little + 1) << 24;
+}
+
+// Four words at a time in independent lanes, so the multiplies overlap, then a word and a byte at a time
+static uint64_t checksum(uint64_t hash, const unsigned char *data, size_t size)
+{
+    uint64_t lane[4] = { hash, hash ^ 0x9E3779B97F4A7C15u, hash ^ 0xBF58476D1CE4E5B9u, hash ^ 0x94D049BB133111EBu };
+    size_t i = 0;
+    for(; i + 32 <= size; i += 32)
+    {
+        for(int l = 0; l < 4; ++l)
+        {
+            uint64_t word;
+            memcpy(&word, data + i + 8 * l, sizeof(word));
+            lane[l] = (lane[l] ^ word) * 0x9E3779B97F4A7C15u;
+            lane[l] ^= lane[l] >> 29;
+        }
+    }
+    hash = lane[0] ^ (lane[1] * 0xC2B2AE3D27D4EB4Fu) ^ (lane[2] * 0x165667B19E3779F9u) ^ (lane[3] * 0xFF51AFD7ED558CCDu);
+    for(; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * 0x9E3779B97F4A7C15u;
+        hash ^= hash >> 29;
+    }
+    for(; i < size; ++i)
+        hash = (hash ^ data[i]) * 0x100000001B3u;
+    return hash;
+}
+
+static uint64_t blob_checksum(const struct blob_header *header, const void *block)
+{
+    uint64_t hash = checksum(0xCBF29CE484222325u, (const unsigned char*) header,
+                             offsetof(struct blob_header, checksum));
+    return checksum(hash, block, (size_t) header->block_size);
+}
+
+// Fill in table from the blob's header and point it into the blob, -1 if the blob isn't one this build can use:
+//  the wrong magic, version or layout, counts that don't add up to the block, or a checksum that doesn't match
+static int check_blob(KirbTable *table, const void *blob, size_t blob_size)
+{
+    if(blob_size < KIRB_BLOB_HEADER)
+        return -1;
+    struct blob_header header;
+    memcpy(&header, blob, sizeof(header));
+    if(memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != KIRB_BLOB_VERSION ||
+       header.layout != blob_layout() || header.reserved != 0)
+        return -1;
+    for(size_t i = sizeof(header); i < KIRB_BLOB_HEADER; ++i)
+    {
+        if(((const unsigned char*) blob)[i] != 0)
+            return -1; // Past the checksum, so checked here
+    }
+    if(header.num_flags < 0 || header.num_value_opts < 0 || header.num_slots < 1 ||
+       (header.num_slots & (header.num_slots - 1)) != 0 || header.names_size < 0 || header.num_nodes < 1 ||
+       header.block_size > blob_size - KIRB_BLOB_HEADER)
+        return -1;
+    // Counts too big for the block would lay it out past its end
+    uint64_t fixed = 2 * 256 * sizeof(int) + (uint64_t) header.num_slots * sizeof(struct KirbSlot)
+                     + (uint64_t) header.num_nodes * (sizeof(struct KirbNode) + 1)
+                     + ((uint64_t) header.num_flags + (uint64_t) header.num_value_opts) * (sizeof(int) + 1);
+    if(fixed + (uint64_t) header.names_size > header.block_size)
+        return -1;
+
+    table->num_flags = header.num_flags;
+    table->num_value_opts = header.num_value_opts;
+    table->num_slots = header.num_slots;
+    table->names_size = header.names_size;
+    table->num_nodes = header.num_nodes;
+    table->block = (char*) blob + KIRB_BLOB_HEADER;
+    table->block_size = (size_t) header.block_size;
+    kirb_table_layout(table);
+    if((size_t) (table->names - (char*) table->block) + (size_t) table->names_size != table->block_size ||
+       blob_checksum(&header, table->block) != header.checksum)
+    {
+        table->block = NULL;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,248 @@
+// kirbcommand.c
+// Subcommands: the global options, then the rules of whichever subcommand the first anonymous value names, each
+//  subcommand compiled the first time it's used
+
+#include "kirbparse.h"
+#include "kirbparse_internal.h"
+
+#if !defined(_WIN32)
+    #include <stdatomic.h>
+#endif
+
+// File-scope types
+// Hashed subcommand name
+struct command_slot
+{
+    unsigned int hash;
+    int command; // -1 if the slot is empty
+};
+
+struct KirbCommands
+{
+    const KirbContext *ctx;      // Global rules, and the settings every subcommand parses with
+    KirbCommand *commands;       // Copies of the caller's, the rule lists themselves aren't copied
+    int num_commands;
+    int num_slots;               // Always a power of two, at least twice num_commands
+    struct command_slot *slots;
+#if !defined(_WIN32)
+    _Atomic(KirbContext*) *compiled; // Each subcommand's context, NULL until it's first used
+#else
+    KirbContext *volatile *compiled; // No atomics on Windows yet, so there a registry is only safe on one thread
+#endif
+};
+
+// File-scope helper functions
+static int probe(const KirbCommands *commands, const char *name, unsigned int hash);
+
+KirbCommands *Kirb_commands_create(const KirbContext *ctx, const KirbCommand *list, int num_commands)
+{
+    if(kirb_check_context(ctx) == -1 || num_commands < 1 || list == NULL)
+        return NULL;
+    for(int c = 0; c < num_commands; ++c)
+    {
+        const KirbCommand *command = &list[c];
+        if(command->name == NULL || command->name[0] == '\0' || command->num_flags < 0 ||
+           command->num_value_opts < 0 ||
+           (command->num_flags > 0 && (command->flags == NULL || command->flags_long == NULL)) ||
+           (command->num_value_opts > 0 && (command->value_opts == NULL || command->value_opts_long == NULL)))
+            return NULL;
+    }
+
+    int num_slots = 1;
+    while(num_slots < 2 * num_commands)
+        num_slots <<= 1;
+
+    // One allocation: the registry, the copied commands, the slots and the compiled contexts
+    size_t size = sizeof(KirbCommands) + num_commands * sizeof(KirbCommand)
+                  + num_slots * sizeof(struct command_slot) + num_commands * sizeof(KirbContext*);
+    KirbCommands *commands = kirb_alloc(ctx, size);
+    if(commands == NULL)
+        return NULL;
+    commands->ctx = ctx;
+    commands->commands = (KirbCommand*) (commands + 1);
+    commands->num_commands = num_commands;
+    commands->num_slots = num_slots;
+    commands->slots = (struct command_slot*) (commands->commands + num_commands);
+    commands->compiled = (void*) (commands->slots + num_slots);
+    memcpy(commands->commands, list, num_commands * sizeof(KirbCommand));
+
+    for(int s = 0; s < num_slots; ++s)
+        commands->slots[s].command = -1;
+    for(int c = 0; c < num_commands; ++c)
+    {
+        unsigned int hash = kirb_hash(list[c].name);
+        int s = probe(commands, list[c].name, hash);
+        if(commands->slots[s].command != -1)
+        {
+            kirb_release(ctx, commands); // Two subcommands with the same name
+            return NULL;
+        }
+        commands->slots[s].hash = hash;
+        commands->slots[s].command = c;
+#if !defined(_WIN32)
+        atomic_init(&commands->compiled[c], NULL);
+#else
+        commands->compiled[c] = NULL;
+#endif
+    }
+
+    // Inference is done now rather than at the first use, which may be on any thread
+    for(int c = 0; c < num_commands; ++c)
+    {
+        KirbCommand *command = &commands->commands[c];
+        if(command->infer == 1)
+        {
+            for(int i = 0; i < command->num_flags; ++i)
+                command->flags[i] = command->flags_long[i][0];
+            for(int i = 0; i < command->num_value_opts; ++i)
+                command->value_opts[i] = command->value_opts_long[i][0];
+            command->infer = 0;
+        }
+    }
+    return commands;
+}
+
+void Kirb_commands_free(KirbCommands *commands)
+{
+    if(commands == NULL)
+        return;
+    for(int c = 0; c < commands->num_commands; ++c)
+    {
+        KirbContext *sub = commands->compiled[c];
+        if(sub != NULL)
+        {
+            Kirb_free_table(&sub->table);
+            kirb_release(commands->ctx, sub);
+        }
+    }
+    kirb_release(commands->ctx, commands);
+}
+
+int Kirb_find_command(const KirbCommands *commands, const char *name)
+{
+    if(commands == NULL || name == NULL)
+        return -1;
+    return commands->slots[probe(commands, name, kirb_hash(name))].command;
+}
+
+const KirbContext *Kirb_command_context(KirbCommands *commands, int command)
+{
+    if(commands == NULL || command < 0 || command >= commands->num_commands)
+        return NULL;
+#if !defined(_WIN32)
+    KirbContext *sub = atomic_load_explicit(&commands->compiled[command], memory_order_acquire);
+#else
+    KirbContext *sub = commands->compiled[command];
+#endif
+    if(sub != NULL)
+        return sub;
+
+    sub = kirb_alloc(commands->ctx, sizeof(KirbContext));
+    if(sub == NULL)
+        return NULL;
+    *sub = *commands->ctx;
+    sub->conflicts = NULL; // Those name the global flags
+    sub->num_conflicts = 0;
+    const KirbCommand *c = &commands->commands[command];
+    if(Kirb_compile(&sub->table, c->num_flags, c->flags, c->flags_long,
+                    c->num_value_opts, c->value_opts, c->value_opts_long, 0) != 0)
+    {
+        kirb_release(commands->ctx, sub);
+        return NULL;
+    }
+
+#if !defined(_WIN32)
+    // Two threads can compile the same subcommand at once, the one that gets there second uses the first's
+    KirbContext *first = NULL;
+    if(!atomic_compare_exchange_strong_explicit(&commands->compiled[command], &first, sub,
+                                                memory_order_acq_rel, memory_order_acquire))
+    {
+        Kirb_free_table(&sub->table);
+        kirb_release(commands->ctx, sub);
+        return first;
+    }
+#else
+    commands->compiled[command] = sub;
+#endif
+    return sub;
+}
+
+int Kirb_parse_global(int argc, char **argv, KirbCommands *commands,
+                      int *flags_out, char **values_out, int *command, int *next)
+{
+    if(commands == NULL || argc < 1 || argv == NULL || command == NULL || next == NULL)
+        return -1;
+    const KirbContext *ctx = commands->ctx;
+    const KirbTable *table = &ctx->table;
+    for(int i = 0; i < table->num_flags; ++i)
+        flags_out[i] = 0;
+    for(int i = 0; i < table->num_value_opts; ++i)
+        values_out[i] = NULL;
+    *command = -1;
+    *next = argc;
+
+    struct tally tally;
+    int slot_count[table->num_slots];
+    kirb_tally_begin(&tally, slot_count, table->num_slots);
+
+    // Only the global options are looked at, the subcommand's arguments are left for its own rules
+    struct walk walk;
+    kirb_walk_begin(&walk, ctx, &tally, flags_out, values_out);
+    int i, mark = PROGRAM;
+    for(i = 0; i < argc; ++i)
+    {
+        mark = kirb_walk_arg(&walk, argv[i]);
+        if(mark == ANONYMOUS || mark == -1)
+            break;
+    }
+
+    int ret = kirb_walk_end(&walk);
+    if(ret == 1 || mark == -1 || ret == -2)
+    {
+        if(ctx->debug && ret != 1)
+            kirb_event(ctx, EVENT_MISSING_VALUE, -1, NULL);
+        for(int j = 0; j < table->num_flags; ++j)
+            flags_out[j] = 0;
+        for(int j = 0; j < table->num_value_opts; ++j)
+            values_out[j] = NULL;
+        return 1;
+    }
+    if(i == argc)
+        return 0; // No subcommand given, which is the caller's to judge
+
+    *next = i + 1;
+    *command = Kirb_find_command(commands, argv[i]);
+    if(*command == -1)
+    {
+        if(ctx->debug)
+            kirb_event(ctx, EVENT_UNKNOWN_COMMAND, i, argv[i]);
+        return 1;
+    }
+    return 0;
+}
+
+int Kirb_parse_command(int argc, char **argv, KirbCommands *commands, int command, int next,
+                       int *flags_out, char **values_out, int *num_anon, char ***anon_out)
+{
+    if(argv == NULL || next < 1 || next > argc)
+        return -1;
+    const KirbContext *sub = Kirb_command_context(commands, command);
+    if(sub == NULL)
+        return -1;
+    // The subcommand's name stands in for the program name, so nothing before it is looked at again
+    return Kirb_parse_all_ctx(argc - next + 1, argv + next - 1, sub, flags_out, values_out, num_anon, anon_out);
+}
+
+// Slot holding name, or the empty slot where it would go
+static int probe(const KirbCommands *commands, const char *name, unsigned int hash)
+{
+    int mask = commands->num_slots - 1;
+    int s = (int) (hash & mask);
+    while(commands->slots[s].command != -1)
+    {
+        if(commands->slots[s].hash == hash && strcmp(commands->commands[commands->slots[s].command].name, name) == 0)
+            break;
+        s = (s + 1) & mask;
+    }
+    return s;
+}
@@ -0,0 +1,271 @@
+// kirbcomplete.c
+// Shell completion: what the word under the cursor is, by the mark phase's rules, and the options it could become,
+//  read off the long name trie in sorted order
+
+#include "kirbparse.h"
+#include "kirbparse_internal.h"
+#include <ctype.h>
+
+// File-scope types
+// Where the matches are written
+struct sink
+{
+    char *out;
+    size_t size;
+    size_t used;
+    int count;
+    int full;
+};
+
+// File-scope helper functions
+static void emit(struct sink *sink, const char *dashes, const char *text);
+static void emit_names(const KirbTable *table, int node, struct sink *sink);
+static void complete_option(const KirbTable *table, const char *word, struct sink *sink);
+static void complete_choice(const KirbType *type, const char *word, struct sink *sink);
+static void script_name(FILE *out, const char *program);
+static void shell_quote(FILE *out, const char *text, int fish);
+static int is_plain(const char *text);
+
+int Kirb_complete(int argc, char **argv, const KirbContext *ctx, const KirbType *types,
+                  char *out, size_t out_size, int *num_matches, enum Mark *mark, int *value_opt)
+{
+    if(kirb_check_context(ctx) == -1 || argc < 1 || argv == NULL || out == NULL || out_size == 0 ||
+       num_matches == NULL)
+        return -1;
+
+    const KirbTable *table = &ctx->table;
+    struct sink sink = { out, out_size, 0, 0, 0 };
+    out[0] = '\0';
+    *num_matches = 0;
+
+    // The word under the cursor is marked just like Kirb_mark would mark it, from the argument before it
+    const char *word = argv[argc - 1];
+    enum Mark m = argc == 1 ? PROGRAM : kirb_mark_one(table, argv, argc - 1);
+    int v = -1;
+    if(m == VALUE)
+    {
+        const char *before = argv[argc - 2];
+        v = kirb_value(table, before);
+        if(v == -1) // A bare "--" takes a value when '-' is a short value option
+            v = table->short_value['-'];
+    }
+    if(mark != NULL)
+        *mark = m;
+    if(value_opt != NULL)
+        *value_opt = v;
+
+    if(m == OPTION_SHORT || m == OPTION_LONG)
+        complete_option(table, word, &sink);
+    else if(m == VALUE && v != -1 && types != NULL && types[v].kind == KIRB_CHOICE)
+        complete_choice(&types[v], word, &sink);
+
+    *num_matches = sink.count;
+    return sink.full ? -2 : 0;
+}
+
+int Kirb_completion_script(FILE *out, const char *shell, const char *program)
+{
+    if(out == NULL || shell == NULL || program == NULL || program[0] == '\0')
+        return -1;
+    // The scripts run program as given, but are registered for its bare name, which is what gets typed
+    const char *command = strrchr(program, '/');
+    command = command != NULL ? command + 1 : program;
+
+    // Each script hands the words up to and including the one under the cursor back to the program, which
+    //  answers through Kirb_complete. With nothing to offer, the shell falls back to completing file names
+    // Both names are quoted for the shell, so a path with spaces or quotes in it stays one word and is never run
+    if(strcmp(shell, "bash") == 0)
+    {
+        fprintf(out, "_");
+        script_name(out, program);
+        fprintf(out, "_complete()\n{\n"
+                     "    local IFS=$'\\n'\n"
+                     "    COMPREPLY=($(");
+        shell_quote(out, program, 0);
+        fprintf(out, " %s \"${COMP_WORDS[@]:1:COMP_CWORD}\" 2>/dev/null))\n"
+                     "}\n"
+                     "complete -o default -F _", KIRB_COMPLETE_COMMAND);
+        script_name(out, program);
+        fprintf(out, "_complete ");
+        shell_quote(out, command, 0);
+        fprintf(out, "\n");
+    }
+    else if(strcmp(shell, "zsh") == 0)
+    {
+        // The #compdef tag line can't be quoted, and is only needed when the script is installed rather than sourced
+        if(is_plain(command))
+            fprintf(out, "#compdef %s\n", command);
+        fprintf(out, "_");
+        script_name(out, program);
+        fprintf(out, "_complete()\n{\n"
+                     "    local -a matches\n"
+                     "    matches=(${(f)\"$(");
+        shell_quote(out, program, 0);
+        fprintf(out, " %s \"${(@)words[2,CURRENT]}\" 2>/dev/null)\"})\n"
+                     "    if (( ${#matches} )); then\n"
+                     "        compadd -a matches\n"
+                     "    else\n"
+                     "        _files\n"
+                     "    fi\n"
+                     "}\n"
+                     "compdef _", KIRB_COMPLETE_COMMAND);
+        script_name(out, program);
+        fprintf(out, "_complete ");
+        shell_quote(out, command, 0);
+        fprintf(out, "\n");
+    }
+    else if(strcmp(shell, "fish") == 0)
+    {
+        // A function of its own, so program is only quoted once rather than inside the -a string
+        fprintf(out, "function _");
+        script_name(out, program);
+        fprintf(out, "_complete\n    ");
+        shell_quote(out, program, 1);
+        fprintf(out, " %s (commandline -opc)[2..-1] (commandline -ct) 2>/dev/null\nend\ncomplete -c ",
+                KIRB_COMPLETE_COMMAND);
+        shell_quote(out, command, 1);
+        fprintf(out, " -a '(_");
+        script_name(out, program);
+        fprintf(out, "_complete)'\n");
+    }
+    else
+        return -1;
+    return ferror(out) ? -1 : 0;
+}
+
+// Append one match and a newline, or note that it didn't fit
+static void emit(struct sink *sink, const char *dashes, const char *text)
+{
+    size_t dash_length = strlen(dashes), length = strlen(text);
+    if(sink->full || sink->used + dash_length + length + 2 > sink->size)
+    {
+        sink->full = 1;
+        return;
+    }
+    memcpy(sink->out + sink->used, dashes, dash_length);
+    memcpy(sink->out + sink->used + dash_length, text, length);
+    sink->used += dash_length + length;
+    sink->out[sink->used++] = '\n';
+    sink->out[sink->used] = '\0';
+    ++sink->count;
+}
+
+// Every long name at or below node, in order: a node's own name sorts before its children's, and the children
+//  were laid out in label order
+static void emit_names(const KirbTable *table, int node, struct sink *sink)
+{
+    const struct KirbNode *n = &table->nodes[node];
+    if(n->exact != -1)
+        emit(sink, "--", table->names + table->slots[n->exact].name);
+    for(int c = n->children; c < n->children + n->num_children && !sink->full; ++c)
+        emit_names(table, c, sink);
+}
+
+static void complete_option(const KirbTable *table, const char *word, struct sink *sink)
+{
+    if(word[1] == '\0')
+    {
+        // Just a dash, so any short option, then every long one
+        char text[2] = { 0, 0 };
+        for(int c = 1; c < 256; ++c)
+        {
+            if(c != '-' && (table->short_flag[c] != -1 || table->short_value[c] != -1))
+            {
+                text[0] = (char) c;
+                emit(sink, "-", text);
+            }
+        }
+        emit_names(table, 0, sink);
+        return;
+    }
+    if(word[1] != '-')
+    {
+        // A short option is already whole
+        if(word[2] == '\0' && (table->short_flag[(unsigned char) word[1]] != -1 ||
+                               table->short_value[(unsigned char) word[1]] != -1))
+            emit(sink, "", word);
+        return;
+    }
+
+    // Down the trie as far as the prefix goes, then everything below
+    int node = 0;
+    for(const char *at = word + 2; *at != '\0'; ++at)
+    {
+        const struct KirbNode *n = &table->nodes[node];
+        int next = -1;
+        for(int c = n->children; c < n->children + n->num_children; ++c)
+        {
+            if(table->labels[c] == (unsigned char) *at)
+            {
+                next = c;
+                break;
+            }
+        }
+        if(next == -1)
+            return;
+        node = next;
+    }
+    emit_names(table, node, sink);
+}
+
+// Choices starting with word, sorted
+static void complete_choice(const KirbType *type, const char *word, struct sink *sink)
+{
+    size_t length = strlen(word);
+    const char *last = NULL;
+    // Choice lists are short, so picking the next one up each time beats sorting a copy
+    for(;;)
+    {
+        const char *next = NULL;
+        for(int c = 0; c < type->num_choices; ++c)
+        {
+            const char *choice = type->choices[c];
+            if(choice == NULL || strncmp(choice, word, length) != 0 || (last != NULL && strcmp(choice, last) <= 0))
+                continue;
+            if(next == NULL || strcmp(choice, next) < 0)
+                next = choice;
+        }
+        if(next == NULL || sink->full)
+            return;
+        emit(sink, "", next);
+        last = next;
+    }
+}
+
+// The program's name made fit for a shell function name
+static void script_name(FILE *out, const char *program)
+{
+    const char *base = strrchr(program, '/');
+    for(const char *at = base != NULL ? base + 1 : program; *at != '\0'; ++at)
+        fputc(isalnum((unsigned char) *at) ? *at : '_', out);
+}
+
+// text in single quotes. Inside them bash and zsh take everything literally, so a quote closes them, is escaped
+//  and reopens them. fish escapes a quote or backslash with a backslash instead
+static void shell_quote(FILE *out, const char *text, int fish)
+{
+    fputc('\'', out);
+    for(const char *at = text; *at != '\0'; ++at)
+    {
+        if(*at == '\'' && !fish)
+            fputs("'\\''", out);
+        else
+        {
+            if(fish && (*at == '\'' || *at == '\\'))
+                fputc('\\', out);
+            fputc(*at, out);
+        }
+    }
+    fputc('\'', out);
+}
+
+// Whether text is nothing but letters, digits and ._+-, so it means the same to a shell without quotes
+static int is_plain(const char *text)
+{
+    for(const char *at = text; *at != '\0'; ++at)
+    {
+        if(!isalnum((unsigned char) *at) && strchr("._+-", *at) == NULL)
+            return 0;
+    }
+    return 1;
+}
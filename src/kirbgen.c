@@ -0,0 +1,126 @@
+// Compiles rules into a blob for Kirb_load_table, see PRECOMPILED RULES
+// Usage: KirbGen [--infer] [--binary] [--name symbol] --output file rule...
+// Each rule is f:long[:s] for a flag or v:long[:s] for a value option, s being its short character. Rules keep
+//  their order, which gives the flag and value option indices. Without --binary the blob is written as a C array
+//  called symbol (kirb_rules by default) to #include, with it the blob is written as is for Kirb_map_table
+
+#include "kirbparse.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// File-scope helper functions
+static int add_rule(char *rule, int *num_flags, char *flags, char **flags_long,
+                    int *num_value_opts, char *value_opts, char **value_opts_long);
+static int write_array(const char *path, const char *symbol, const unsigned char *blob, size_t size,
+                       int num_flags, char **flags_long, int num_value_opts, char **value_opts_long);
+
+int main(int argc, char **argv)
+{
+    char options[] = "bi", *options_long[] = { "binary", "infer" };
+    char settings[] = "on", *settings_long[] = { "output", "name" };
+    KirbContext ctx;
+    if(Kirb_context_init(&ctx, stdout, stderr, 2, options, options_long, 2, settings, settings_long, 0, 0) != 0)
+        return 1;
+
+    int given[2], num_rules = 0;
+    char *values[2], **rules = NULL;
+    if(Kirb_parse_all_ctx(argc, argv, &ctx, given, values, &num_rules, &rules) != 0 || values[0] == NULL ||
+       num_rules == 0)
+    {
+        fprintf(stderr, "Usage: %s [--infer] [--binary] [--name symbol] --output file f:long[:s]|v:long[:s]...\n",
+                argv[0]);
+        Kirb_context_free(&ctx);
+        return 1;
+    }
+    int binary = given[0], infer = given[1];
+    const char *output = values[0], *symbol = values[1] != NULL ? values[1] : "kirb_rules";
+
+    int num_flags = 0, num_value_opts = 0;
+    char *flags = malloc(num_rules), *value_opts = malloc(num_rules);
+    char **flags_long = malloc(num_rules * sizeof(char*)), **value_opts_long = malloc(num_rules * sizeof(char*));
+    int ret = flags != NULL && value_opts != NULL && flags_long != NULL && value_opts_long != NULL ? 0 : 1;
+    for(int i = 0; i < num_rules && ret == 0; ++i)
+    {
+        ret = add_rule(rules[i], &num_flags, flags, flags_long, &num_value_opts, value_opts, value_opts_long);
+        if(ret != 0)
+            fprintf(stderr, "%s: bad rule %s, expected f:long[:s] or v:long[:s]\n", argv[0], rules[i]);
+    }
+
+    KirbTable table;
+    if(ret == 0 && Kirb_compile(&table, num_flags, flags, flags_long, num_value_opts, value_opts, value_opts_long,
+                                infer) == 0)
+    {
+        size_t size = Kirb_table_blob_size(&table);
+        unsigned char *blob = malloc(size);
+        if(blob == NULL || Kirb_save_table(&table, blob, size) != 0)
+            ret = 1;
+        else if(binary)
+            ret = Kirb_write_table(&table, output) == 0 ? 0 : 1;
+        else
+            ret = write_array(output, symbol, blob, size, num_flags, flags_long, num_value_opts, value_opts_long);
+        if(ret != 0)
+            fprintf(stderr, "%s: couldn't write %s\n", argv[0], output);
+        free(blob);
+        Kirb_free_table(&table);
+    }
+    else
+        ret = 1;
+
+    free(flags);
+    free(value_opts);
+    free(flags_long);
+    free(value_opts_long);
+    Kirb_free_anon(&ctx, rules);
+    Kirb_context_free(&ctx);
+    return ret;
+}
+
+// Split rule in place and append it to the flags or the value options
+static int add_rule(char *rule, int *num_flags, char *flags, char **flags_long,
+                    int *num_value_opts, char *value_opts, char **value_opts_long)
+{
+    if((rule[0] != 'f' && rule[0] != 'v') || rule[1] != ':' || rule[2] == '\0' || rule[2] == ':')
+        return 1;
+    char *name = rule + 2, *colon = strchr(name, ':'), opt = '\0';
+    if(colon != NULL)
+    {
+        if(colon[1] == '\0' || colon[2] != '\0')
+            return 1;
+        *colon = '\0';
+        opt = colon[1];
+    }
+    if(rule[0] == 'f')
+    {
+        flags[*num_flags] = opt;
+        flags_long[(*num_flags)++] = name;
+    }
+    else
+    {
+        value_opts[*num_value_opts] = opt;
+        value_opts_long[(*num_value_opts)++] = name;
+    }
+    return 0;
+}
+
+static int write_array(const char *path, const char *symbol, const unsigned char *blob, size_t size,
+                       int num_flags, char **flags_long, int num_value_opts, char **value_opts_long)
+{
+    FILE *out = fopen(path, "w");
+    if(out == NULL)
+        return 1;
+    fprintf(out, "// Generated by KirbGen, do not edit. Load with Kirb_load_table(&table, %s, sizeof(%s))\n",
+            symbol, symbol);
+    fprintf(out, "// Flags:");
+    for(int i = 0; i < num_flags; ++i)
+        fprintf(out, " %d --%s", i, flags_long[i]);
+    fprintf(out, "\n// Value options:");
+    for(int i = 0; i < num_value_opts; ++i)
+        fprintf(out, " %d --%s", i, value_opts_long[i]);
+    fprintf(out, "\n\n#if defined(__cplusplus)\nalignas(32)\n#else\n_Alignas(32)\n#endif\n");
+    fprintf(out, "static const unsigned char %s[%zu] = {", symbol, size);
+    for(size_t i = 0; i < size; ++i)
+        fprintf(out, "%s0x%02x%s", i % 16 == 0 ? "\n    " : "", blob[i], i + 1 < size ? "," : "");
+    fprintf(out, "\n};\n");
+    return fclose(out) == 0 ? 0 : 1;
+}
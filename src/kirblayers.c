@@ -0,0 +1,481 @@
+// kirblayers.c
+// Option values layered from defaults, a key=value config file, prefixed environment variables and the command
+//  line, in that order, with where each one came from
+
+#include "kirbparse.h"
+#include "kirbparse_internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#if !defined(_WIN32)
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+    #if !defined(MAP_ANONYMOUS)
+        #define MAP_ANONYMOUS MAP_ANON
+    #endif
+extern char **environ;
+#else
+    #define environ _environ
+#endif
+
+// Environment variable names longer than this can't be one of ours
+#define KIRB_ENV_NAME 256
+
+// File-scope types
+// What a config file looked like when it was loaded, so an unchanged one isn't loaded again
+struct stamp
+{
+    uint64_t device;
+    uint64_t inode;
+    int64_t size;
+    int64_t seconds;
+    int64_t nanoseconds;
+};
+
+struct KirbLayers
+{
+    const KirbContext *ctx;
+    const int *default_flags;    // NULL if there are no defaults
+    char **default_values;
+    const char *config_path;     // Copies of the caller's, NULL if not given
+    const char *env_prefix;
+    size_t prefix_length;
+    int cache;
+
+    // The config file as last loaded, parsed in place
+    char *data;                  // NULL if there's no file
+    size_t size;                 // Bytes mapped (or allocated) at data
+    int mapped;
+    int loaded;                  // Whether stamp describes the file at config_path
+    struct stamp stamp;
+    int bad_line;                // First line with a bad setting, 0 if there isn't one
+    const char *bad_key;
+    int *config_flags;           // -1 if the file doesn't set it
+    char **config_values;
+};
+
+// File-scope helper functions
+static int load_config(KirbLayers *layers);
+#if !defined(_WIN32)
+static struct stamp make_stamp(const struct stat *st);
+#endif
+static void unload_config(KirbLayers *layers);
+static void parse_config(KirbLayers *layers, char *data, size_t size);
+static char *trim(char *start, char *end);
+static int scan_env(const KirbLayers *layers, int *env_flags, char **env_values, const char **bad);
+static int parse_switch(const char *text);
+
+KirbLayers *Kirb_layers_create(const KirbContext *ctx, const int *default_flags, char **default_values,
+                               const char *config_path, const char *env_prefix, int cache)
+{
+    if(kirb_check_context(ctx) == -1 || (env_prefix != NULL && env_prefix[0] == '\0'))
+        return NULL;
+    const KirbTable *table = &ctx->table;
+    size_t path_length = config_path != NULL ? strlen(config_path) + 1 : 0;
+    size_t prefix_length = env_prefix != NULL ? strlen(env_prefix) + 1 : 0;
+
+    // One allocation: the layers, the defaults, the config file's settings and the copied strings
+    size_t size = sizeof(KirbLayers) + table->num_value_opts * 2 * sizeof(char*)
+                  + table->num_flags * 2 * sizeof(int) + path_length + prefix_length;
+    KirbLayers *layers = kirb_alloc(ctx, size);
+    if(layers == NULL)
+        return NULL;
+    memset(layers, 0, sizeof(KirbLayers));
+    layers->ctx = ctx;
+    layers->cache = cache;
+
+    char **default_copy = (char**) (layers + 1);
+    layers->config_values = default_copy + table->num_value_opts;
+    int *default_flag_copy = (int*) (layers->config_values + table->num_value_opts);
+    layers->config_flags = default_flag_copy + table->num_flags;
+    char *strings = (char*) (layers->config_flags + table->num_flags);
+    if(default_flags != NULL)
+    {
+        memcpy(default_flag_copy, default_flags, table->num_flags * sizeof(int));
+        layers->default_flags = default_flag_copy;
+    }
+    if(default_values != NULL)
+    {
+        memcpy(default_copy, default_values, table->num_value_opts * sizeof(char*));
+        layers->default_values = default_copy;
+    }
+    if(config_path != NULL)
+    {
+        memcpy(strings, config_path, path_length);
+        layers->config_path = strings;
+    }
+    if(env_prefix != NULL)
+    {
+        memcpy(strings + path_length, env_prefix, prefix_length);
+        layers->env_prefix = strings + path_length;
+        layers->prefix_length = prefix_length - 1;
+    }
+    for(int i = 0; i < table->num_flags; ++i)
+        layers->config_flags[i] = -1;
+    for(int i = 0; i < table->num_value_opts; ++i)
+        layers->config_values[i] = NULL;
+    return layers;
+}
+
+void Kirb_layers_free(KirbLayers *layers)
+{
+    if(layers == NULL)
+        return;
+    unload_config(layers);
+    kirb_release(layers->ctx, layers);
+}
+
+int Kirb_parse_layered(int argc, char **argv, KirbLayers *layers, int *flags_out, char **values_out,
+                       int *flag_origins, int *value_origins, int *num_anon, char ***anon_out)
+{
+    if(layers == NULL)
+        return -1;
+    const KirbContext *ctx = layers->ctx;
+    const KirbTable *table = &ctx->table;
+    int ret = Kirb_parse_all_ctx(argc, argv, ctx, flags_out, values_out, num_anon, anon_out);
+    if(ret != 0 && ret != 2)
+        return ret;
+
+    // The command line is in, now whatever it didn't set comes from the layers below it, highest first
+    int env_flags[table->num_flags + 1];
+    char *env_values[table->num_value_opts + 1];
+    const char *bad = NULL;
+    int failed = load_config(layers);
+    if(failed == 0 && layers->bad_line != 0)
+    {
+        if(ctx->debug)
+            kirb_event(ctx, EVENT_BAD_SETTING, layers->bad_line, layers->bad_key);
+        failed = 1;
+    }
+    if(failed == 0 && scan_env(layers, env_flags, env_values, &bad) != 0)
+    {
+        if(ctx->debug)
+            kirb_event(ctx, EVENT_BAD_SETTING, -1, bad);
+        failed = 1;
+    }
+    if(failed != 0)
+    {
+        for(int i = 0; i < table->num_flags; ++i)
+            flags_out[i] = 0;
+        for(int i = 0; i < table->num_value_opts; ++i)
+            values_out[i] = NULL;
+        kirb_release(ctx, *anon_out);
+        *anon_out = NULL;
+        return failed;
+    }
+
+    for(int i = 0; i < table->num_flags; ++i)
+    {
+        int origin = KIRB_ORIGIN_ARGV;
+        if(flags_out[i] == 0)
+        {
+            origin = KIRB_ORIGIN_NONE;
+            if(env_flags[i] != -1)
+            {
+                flags_out[i] = env_flags[i];
+                origin = KIRB_ORIGIN_ENV;
+            }
+            else if(layers->config_flags[i] != -1)
+            {
+                flags_out[i] = layers->config_flags[i];
+                origin = KIRB_ORIGIN_CONFIG;
+            }
+            else if(layers->default_flags != NULL)
+            {
+                flags_out[i] = layers->default_flags[i];
+                origin = KIRB_ORIGIN_DEFAULT;
+            }
+        }
+        if(flag_origins != NULL)
+            flag_origins[i] = origin;
+    }
+    for(int i = 0; i < table->num_value_opts; ++i)
+    {
+        int origin = KIRB_ORIGIN_ARGV;
+        if(values_out[i] == NULL)
+        {
+            origin = KIRB_ORIGIN_NONE;
+            if(env_values[i] != NULL)
+            {
+                values_out[i] = env_values[i];
+                origin = KIRB_ORIGIN_ENV;
+            }
+            else if(layers->config_values[i] != NULL)
+            {
+                values_out[i] = layers->config_values[i];
+                origin = KIRB_ORIGIN_CONFIG;
+            }
+            else if(layers->default_values != NULL && layers->default_values[i] != NULL)
+            {
+                values_out[i] = layers->default_values[i];
+                origin = KIRB_ORIGIN_DEFAULT;
+            }
+        }
+        if(value_origins != NULL)
+            value_origins[i] = origin;
+    }
+    return ret;
+}
+
+// Make the config file's settings current, -1 if it exists but couldn't be loaded
+// With the cache on, a file with the same identity, size and modification time as last time isn't looked at again
+static int load_config(KirbLayers *layers)
+{
+    if(layers->config_path == NULL)
+        return 0;
+
+#if !defined(_WIN32)
+    struct stat st;
+    if(stat(layers->config_path, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        unload_config(layers); // No file is no settings
+        return 0;
+    }
+    struct stamp stamp = make_stamp(&st);
+    if(layers->cache && layers->loaded && memcmp(&stamp, &layers->stamp, sizeof(stamp)) == 0)
+        return 0;
+    unload_config(layers);
+
+    int fd = open(layers->config_path, O_RDONLY);
+    if(fd == -1)
+        return 0;
+    // It may have changed since the stat, and the stamp has to describe what's actually loaded
+    if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        close(fd);
+        return 0;
+    }
+    stamp = make_stamp(&st);
+
+    size_t size = (size_t) st.st_size;
+    char *data = NULL;
+    size_t map_size = 0;
+    if(size > 0)
+    {
+        // Same as a response file: parsing needs a byte past the end for the last NUL, which comes from an
+        //  anonymous page when the file fills its last page exactly
+        long page = sysconf(_SC_PAGESIZE);
+        map_size = (size + 1 + page - 1) / page * page;
+        data = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(data == MAP_FAILED)
+        {
+            close(fd);
+            return -1;
+        }
+        if(mmap(data, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)
+        {
+            munmap(data, map_size);
+            close(fd);
+            return -1;
+        }
+        layers->mapped = 1;
+    }
+    close(fd);
+    layers->stamp = stamp;
+#else
+    // No stamp to go on, so the file is read every time
+    unload_config(layers);
+    FILE *file = fopen(layers->config_path, "rb");
+    if(file == NULL)
+        return 0;
+    long end = -1;
+    if(fseek(file, 0, SEEK_END) == 0)
+        end = ftell(file);
+    if(end < 0 || fseek(file, 0, SEEK_SET) != 0)
+    {
+        fclose(file);
+        return 0;
+    }
+    size_t size = (size_t) end, map_size = size + 1;
+    char *data = malloc(map_size);
+    if(data == NULL || fread(data, 1, size, file) != size)
+    {
+        free(data);
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+#endif
+
+    layers->data = data;
+    layers->size = map_size;
+    layers->loaded = 1;
+    if(data != NULL)
+        parse_config(layers, data, size);
+    return 0;
+}
+
+#if !defined(_WIN32)
+static struct stamp make_stamp(const struct stat *st)
+{
+    struct stamp stamp = { (uint64_t) st->st_dev, (uint64_t) st->st_ino, (int64_t) st->st_size,
+                           (int64_t) st->st_mtime, 0 };
+    #if defined(__linux__)
+    stamp.nanoseconds = (int64_t) st->st_mtim.tv_nsec;
+    #elif defined(__APPLE__)
+    stamp.nanoseconds = (int64_t) st->st_mtimespec.tv_nsec;
+    #endif
+    return stamp;
+}
+#endif
+
+static void unload_config(KirbLayers *layers)
+{
+    const KirbTable *table = &layers->ctx->table;
+    for(int i = 0; i < table->num_flags; ++i)
+        layers->config_flags[i] = -1;
+    for(int i = 0; i < table->num_value_opts; ++i)
+        layers->config_values[i] = NULL;
+    layers->bad_line = 0;
+    layers->bad_key = NULL;
+    layers->loaded = 0;
+    if(layers->data == NULL)
+        return;
+#if !defined(_WIN32)
+    if(layers->mapped)
+        munmap(layers->data, layers->size);
+    else
+        free(layers->data);
+#else
+    free(layers->data);
+#endif
+    layers->data = NULL;
+    layers->mapped = 0;
+}
+
+// Split the file into lines of name = value in place, each name being a long option. Blank lines and lines
+//  starting with # or ; are skipped, and a value in matching quotes loses them. Later lines win
+// A flag's value is a switch (see parse_switch), and a flag on its own turns it on
+static void parse_config(KirbLayers *layers, char *data, size_t size)
+{
+    const KirbTable *table = &layers->ctx->table;
+    char *end = data + size;
+    int line = 0;
+    for(char *at = data; at < end; )
+    {
+        ++line;
+        char *eol = memchr(at, '\n', end - at);
+        if(eol == NULL)
+            eol = end;
+        char *start = at;
+        at = eol + 1;
+        *eol = '\0'; // May be data[size], which is why it was mapped
+
+        while(start < eol && (*start == ' ' || *start == '\t' || *start == '\r'))
+            ++start;
+        if(start == eol || *start == '#' || *start == ';')
+            continue;
+        char *equals = memchr(start, '=', eol - start);
+        char *name = trim(start, equals != NULL ? equals : eol);
+        char *value = equals != NULL ? trim(equals + 1, eol) : NULL;
+        if(value != NULL)
+        {
+            size_t length = strlen(value);
+            if(length >= 2 && (value[0] == '"' || value[0] == '\'') && value[length - 1] == value[0])
+            {
+                value[length - 1] = '\0';
+                ++value;
+            }
+        }
+
+        int s = name[0] != '\0' ? kirb_lookup(table, name) : -1;
+        if(s != -1 && table->slots[s].flag != -1)
+        {
+            // Flags first, as on the command line
+            int on = value == NULL ? 1 : parse_switch(value);
+            if(on != -1)
+            {
+                layers->config_flags[table->slots[s].flag] = on;
+                continue;
+            }
+        }
+        else if(s != -1 && table->slots[s].value != -1 && value != NULL)
+        {
+            layers->config_values[table->slots[s].value] = value;
+            continue;
+        }
+        layers->bad_line = line;
+        layers->bad_key = name;
+        return;
+    }
+}
+
+// NUL terminate the text between start and end without the whitespace around it
+static char *trim(char *start, char *end)
+{
+    while(start < end && (*start == ' ' || *start == '\t'))
+        ++start;
+    while(end > start && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r'))
+        --end;
+    *end = '\0';
+    return start;
+}
+
+// One pass over the environment for the variables named prefix then a long option, in upper case with _ for -
+// Other variables with the prefix are left alone, they may well be some other setting of the program's
+static int scan_env(const KirbLayers *layers, int *env_flags, char **env_values, const char **bad)
+{
+    const KirbTable *table = &layers->ctx->table;
+    for(int i = 0; i < table->num_flags; ++i)
+        env_flags[i] = -1;
+    for(int i = 0; i < table->num_value_opts; ++i)
+        env_values[i] = NULL;
+    if(layers->env_prefix == NULL || environ == NULL)
+        return 0;
+
+    char name[KIRB_ENV_NAME];
+    for(char **env = environ; *env != NULL; ++env)
+    {
+        const char *var = *env;
+        if(strncmp(var, layers->env_prefix, layers->prefix_length) != 0)
+            continue;
+        const char *at = var + layers->prefix_length;
+        size_t length = 0;
+        for(; at[length] != '=' && at[length] != '\0' && length < KIRB_ENV_NAME - 1; ++length)
+        {
+            char c = at[length];
+            name[length] = c == '_' ? '-' : c >= 'A' && c <= 'Z' ? (char) (c - 'A' + 'a') : c;
+        }
+        if(length == 0 || at[length] != '=')
+            continue;
+        name[length] = '\0';
+
+        int s = kirb_lookup(table, name);
+        if(s == -1)
+            continue;
+        char *value = (char*) at + length + 1;
+        if(table->slots[s].flag != -1)
+        {
+            int on = parse_switch(value);
+            if(on == -1)
+            {
+                *bad = var;
+                return 1;
+            }
+            env_flags[table->slots[s].flag] = on;
+        }
+        else
+            env_values[table->slots[s].value] = value;
+    }
+    return 0;
+}
+
+// 1, true, yes or on turn a flag on and 0, false, no, off or nothing turn it off, in any case. -1 if it's none
+static int parse_switch(const char *text)
+{
+    static const char *const words[] = { "1", "true", "yes", "on", "0", "false", "no", "off", "" };
+    for(int w = 0; w < (int) (sizeof(words) / sizeof(words[0])); ++w)
+    {
+        const char *a = text, *b = words[w];
+        while(*a != '\0' && (*a >= 'A' && *a <= 'Z' ? *a - 'A' + 'a' : *a) == *b)
+        {
+            ++a;
+            ++b;
+        }
+        if(*a == '\0' && *b == '\0')
+            return w < 4;
+    }
+    return -1;
+}
@@ -0,0 +1,156 @@
+// kirblazy.c
+// Parsing only as far as the caller's questions need
+
+#include "kirbparse.h"
+#include "kirbparse_internal.h"
+#include <stdint.h>
+
+// The flags, values and tally share the handle's allocation, right after it
+struct KirbLazy
+{
+    const KirbContext *ctx;
+    int argc;
+    char **argv;
+    struct walk walk;   // walk.position is how far the arguments have been resolved
+    struct tally tally;
+    int *flags;
+    char **values;
+    int stopped;        // A value option turned up without its value, the walk goes no further
+    int anon;           // Next argument Kirb_next_anon looks at
+    int status;         // Kirb_finish's result, -1 until it runs
+};
+
+// File-scope helper functions
+static int step(KirbLazy *lazy);
+static int incomplete(const KirbLazy *lazy);
+
+KirbLazy *Kirb_open(int argc, char **argv, const KirbContext *ctx)
+{
+    if(ctx == NULL || ctx->table.block == NULL || argc < 0 || (argc > 0 && argv == NULL))
+        return NULL;
+
+    const KirbTable *table = &ctx->table;
+    size_t size = sizeof(KirbLazy) + table->num_value_opts * sizeof(char*)
+                  + (table->num_flags + table->num_slots) * sizeof(int);
+    KirbLazy *lazy = kirb_alloc(ctx, size);
+    if(lazy == NULL)
+        return NULL;
+
+    lazy->ctx = ctx;
+    lazy->argc = argc;
+    lazy->argv = argv;
+    lazy->values = (char**) (lazy + 1);
+    lazy->flags = (int*) (lazy->values + table->num_value_opts);
+    kirb_tally_begin(&lazy->tally, lazy->flags + table->num_flags, table->num_slots);
+    for(int i = 0; i < table->num_flags; ++i)
+        lazy->flags[i] = 0;
+    for(int i = 0; i < table->num_value_opts; ++i)
+        lazy->values[i] = NULL;
+    kirb_walk_begin(&lazy->walk, ctx, &lazy->tally, lazy->flags, lazy->values);
+    lazy->stopped = 0;
+    lazy->anon = 1;
+    lazy->status = -1;
+    return lazy;
+}
+
+int Kirb_get_flag(KirbLazy *lazy, int flag, int *present)
+{
+    if(lazy == NULL || present == NULL || flag < 0 || flag >= lazy->ctx->table.num_flags)
+        return -1;
+
+    // A flag only ever turns on, so the first sighting settles it
+    while(!lazy->flags[flag] && step(lazy) != -1)
+        ;
+    *present = lazy->flags[flag];
+    return *present || !incomplete(lazy) ? 0 : 1;
+}
+
+int Kirb_get_value(KirbLazy *lazy, int value_opt, char **value)
+{
+    if(lazy == NULL || value == NULL || value_opt < 0 || value_opt >= lazy->ctx->table.num_value_opts)
+        return -1;
+
+    // Without crossover a second sighting is an error anyway, with it the last one wins and only the end can tell
+    if(lazy->ctx->allow_crossover)
+    {
+        while(step(lazy) != -1)
+            ;
+    }
+    else
+    {
+        while(lazy->values[value_opt] == NULL && step(lazy) != -1)
+            ;
+    }
+    *value = lazy->values[value_opt];
+    if(lazy->ctx->allow_crossover)
+        return incomplete(lazy) ? 1 : 0;
+    return *value != NULL || !incomplete(lazy) ? 0 : 1;
+}
+
+int Kirb_next_anon(KirbLazy *lazy, char **anon)
+{
+    if(lazy == NULL || anon == NULL)
+        return -1;
+
+    *anon = NULL;
+    for(; lazy->anon < lazy->argc; ++lazy->anon)
+    {
+        // Marks only depend on the argument before, but the walk still has to get here to catch a missing value
+        while(lazy->walk.position <= lazy->anon)
+        {
+            if(step(lazy) == -1)
+                return 1;
+        }
+        if(kirb_mark_one(&lazy->ctx->table, lazy->argv, lazy->anon) == ANONYMOUS)
+        {
+            *anon = lazy->argv[lazy->anon++];
+            return 0;
+        }
+    }
+    return incomplete(lazy) ? 1 : 0;
+}
+
+int Kirb_finish(KirbLazy *lazy)
+{
+    if(lazy == NULL)
+        return -1;
+    if(lazy->status != -1)
+        return lazy->status;
+
+    while(step(lazy) != -1)
+        ;
+    // Like the fused parse, prep errors past a missing value still count, so the rest gets tallied
+    for(int i = lazy->walk.position + 1; lazy->stopped && lazy->walk.tally != NULL && i < lazy->argc; ++i)
+    {
+        if(lazy->argv[i][0] == '-')
+            kirb_count_arg(&lazy->ctx->table, lazy->argv[i], &lazy->tally);
+    }
+
+    int ret = kirb_walk_end(&lazy->walk);
+    lazy->status = ret != 0 || lazy->stopped ? 1 : 0;
+    return lazy->status;
+}
+
+void Kirb_close(KirbLazy *lazy)
+{
+    if(lazy == NULL)
+        return;
+    kirb_release(lazy->ctx, lazy);
+}
+
+// Resolve the next argument, returning its Mark or -1 once there's nothing more to resolve
+static int step(KirbLazy *lazy)
+{
+    if(lazy->stopped || lazy->walk.position >= lazy->argc)
+        return -1;
+    int mark = kirb_walk_arg(&lazy->walk, lazy->argv[lazy->walk.position]);
+    if(mark == -1)
+        lazy->stopped = 1;
+    return mark;
+}
+
+// Whether Kirb_parse_all would fail on a missing value somewhere in what's been resolved
+static int incomplete(const KirbLazy *lazy)
+{
+    return lazy->stopped || (lazy->walk.position >= lazy->argc && lazy->walk.pending != -1);
+}
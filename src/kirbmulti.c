@@ -0,0 +1,140 @@
+// kirbmulti.c
+// Value options that take more than one value, every value kept as an argv index in one flat array
+
+#include "kirbparse.h"
+#include "kirbparse_internal.h"
+#include <limits.h>
+#include <stdint.h>
+
+int Kirb_parse_multi(int argc, char **argv, const KirbContext *ctx, const int *max_values, const int *per_use,
+                     int *flags_out, int *offsets, int *indices, int *num_anon, char ***anon_out)
+{
+    if(kirb_check_context(ctx) == -1 || argc < 1 || argv == NULL || num_anon == NULL || anon_out == NULL ||
+       offsets == NULL || (ctx->table.num_value_opts > 0 && (max_values == NULL || indices == NULL)))
+        return -1;
+    if(*anon_out != NULL)
+    {
+        if(ctx->debug)
+            kirb_event(ctx, EVENT_ANON_NOT_NULL, -1, NULL);
+    }
+
+    // Each option writes into its own max_values wide stretch of indices, closed up once the parse is over
+    // offsets[v] is where option v's next value goes until then
+    const KirbTable *table = &ctx->table;
+    int base[table->num_value_opts + 1];
+    base[0] = 0;
+    for(int v = 0; v < table->num_value_opts; ++v)
+    {
+        if(max_values[v] < 1 || max_values[v] > INT_MAX - base[v] || (per_use != NULL && per_use[v] < 1))
+            return -1;
+        base[v + 1] = base[v] + max_values[v];
+        offsets[v] = base[v];
+    }
+    for(int i = 0; i < table->num_flags; ++i)
+        flags_out[i] = 0;
+
+    int capacity = argc > 1 ? argc - 1 : 1;
+    char **anon = kirb_alloc(ctx, capacity * sizeof(char*));
+    if(anon == NULL)
+        return -1;
+
+    struct tally tally;
+    int slot_count[table->num_slots];
+    kirb_tally_begin(&tally, slot_count, table->num_slots);
+    struct tally *counting = ctx->allow_crossover == 0 ? &tally : NULL;
+
+    // remaining is how many of the arguments ahead can still be values, taken how many the pending option has had
+    int count = 0, remaining = 0, taken = 0, pending = -1, error = 0, i;
+    for(i = 0; i < argc; ++i)
+    {
+        char *arg = argv[i];
+        if(arg[0] == '-')
+        {
+            if(counting != NULL)
+                kirb_count_arg(table, arg, counting);
+            if(i > 0)
+            {
+                if(pending != -1 && taken == 0)
+                {
+                    error = EVENT_MISSING_VALUE;
+                    break;
+                }
+                int f = kirb_flag(table, arg);
+                if(f > -1)
+                {
+                    flags_out[f] = 1;
+                    pending = -1;
+                }
+                else
+                    pending = kirb_value(table, arg);
+            }
+            remaining = !kirb_takes_value(table, arg) ? 0 : pending != -1 && per_use != NULL ? per_use[pending] : 1;
+            taken = 0;
+        }
+        else
+        {
+            if(i == 0)
+                ;
+            else if(remaining > 0)
+            {
+                if(pending != -1)
+                {
+                    if(offsets[pending] == base[pending + 1])
+                    {
+                        if(ctx->debug)
+                            kirb_event(ctx, EVENT_TOO_MANY_VALUES, i, arg);
+                        error = EVENT_TOO_MANY_VALUES;
+                        break;
+                    }
+                    indices[offsets[pending]++] = i;
+                    ++taken;
+                }
+                if(--remaining == 0)
+                    pending = -1;
+            }
+            else
+                anon[count++] = arg;
+        }
+    }
+    // Flags are still checked for duplicates and crossovers past where extracting stopped, and those errors win
+    for(++i; i < argc && counting != NULL; ++i)
+    {
+        if(argv[i][0] == '-')
+            kirb_count_arg(table, argv[i], counting);
+    }
+
+    if(counting != NULL && kirb_check_tally(ctx, counting, 0) == 1)
+    {
+        // Prep would have stopped Kirb_parse_all before anything was written
+        for(int f = 0; f < table->num_flags; ++f)
+            flags_out[f] = 0;
+        error = EVENT_PREP_ERROR;
+    }
+    else if(error == 0 && pending != -1 && taken == 0)
+        error = EVENT_MISSING_VALUE;
+    if(error != 0)
+    {
+        if(ctx->debug && error == EVENT_MISSING_VALUE)
+            kirb_event(ctx, EVENT_MISSING_VALUE, -1, NULL);
+        for(int v = 0; v <= table->num_value_opts; ++v)
+            offsets[v] = 0;
+        kirb_release(ctx, anon);
+        return 1;
+    }
+
+    // Close up the gaps each option left, moving values towards the front only so nothing is overwritten early
+    int used = 0;
+    for(int v = 0; v < table->num_value_opts; ++v)
+    {
+        int n = offsets[v] - base[v];
+        if(used != base[v])
+            memmove(indices + used, indices + base[v], n * sizeof(int));
+        offsets[v] = used;
+        used += n;
+    }
+    offsets[table->num_value_opts] = used;
+
+    *num_anon = count;
+    *anon_out = anon;
+    return 0;
+}
@@ -2,6 +2,7 @@
 // Implementations for library
 
 #include "kirbparse.h"
+#include "kirbparse_internal.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -12,10 +13,11 @@ FILE *kirbparse_info = NULL;
 FILE *kirbparse_err = NULL;
 
 // File-scope constants
-static const char dash_string[] = "-";
+static const char dash_string[] = "--";
 
 // File-scope helper functions
 static int crossover_check(int argc, char **argv, char opt, char *long_opt);
+static enum Mark mark_one(char **argv, int i, int num_value_opts, char *value_opts, char **value_opts_long);
 static int match_short(int num_opts, char *opts, char *arg);
 static int match_long(int num_long_opts, char **long_opts, char *arg);
 
@@ -25,7 +27,8 @@ int Kirb_parse_all(int argc, char **argv,
                    int *flags_out, char **values_out, int *num_anon, char ***anon_out)
 {
     int prep_ret, mark_ret;
-    enum Mark marks[argc * sizeof(enum Mark)];
+    uint8_t stack_marks[KIRB_STACK_MARKS];
+    uint8_t *marks = stack_marks; // One byte per argument, on the heap when there are too many for the stack
     int anon_fronts = 0;
 
     // Preliminary checks and init
@@ -37,26 +40,8 @@ int Kirb_parse_all(int argc, char **argv,
     {
         *(values_out + i) = NULL;
     }
-    if(kirbparse_info == NULL)
-    {
-        fprintf(kirbparse_err == NULL ? stderr : kirbparse_err,
-                "KIRBPARSE ERROR: information logging file not specified. "
-                        "If this is intended, set kirbparse_info to stdout.\n");
+    if(kirb_check_sinks() == -1)
         return -1;
-    }
-    if(kirbparse_err == NULL)
-    {
-        if(kirbparse_werror)
-        {
-            fprintf(stderr, "ERROR: KIRBPARSE: error logging file not specified. "
-                            "If this is intended, set kirbparse_err to stderr.\n");
-            return -1;
-        }
-
-        fprintf(kirbparse_info, "WARN: KIRBPARSE: error logging file not specified. "
-                                "Will automatically be set to stderr.\n");
-        kirbparse_err = stderr;
-    }
     if(*anon_out != NULL)
     {
         if(kirbparse_debug)
@@ -88,7 +73,19 @@ int Kirb_parse_all(int argc, char **argv,
     // Mark args
     if(kirbparse_debug)
         fprintf(kirbparse_info, "INFO: KIRBPARSE: Begin Mark phase\n");
-    mark_ret = Kirb_mark(argc, argv, num_value_opts, value_opts, value_opts_long, marks);
+    // The parse looks at every mark again (anonymous fronts, the value after each option, the anonymous count), so
+    //  they can't be chunked, but at one byte per argument they're an eighth the size of argv itself
+    if(argc > KIRB_STACK_MARKS)
+    {
+        marks = malloc(argc);
+        if(marks == NULL)
+        {
+            if(kirbparse_debug)
+                fprintf(kirbparse_err, "ERROR: KIRBPARSE: Mark Error: Out of memory for %d marks\n", argc);
+            return -1;
+        }
+    }
+    mark_ret = Kirb_mark_compact(argc, argv, num_value_opts, value_opts, value_opts_long, marks);
     if(mark_ret == -1)
     {
         if(kirbparse_debug)
@@ -131,7 +128,7 @@ int Kirb_parse_all(int argc, char **argv,
                 if(kirbparse_debug)
                     fprintf(kirbparse_info, "INFO: KIRBPARSE: Found short value option at %s\n", argv[i]);
 
-                if(marks[i + 1] == 3)
+                if(i + 1 < argc && marks[i + 1] == 3)
                 {
                     // Add value to output list
                     *(values_out + v) = argv[++i]; // add and skip the value
@@ -143,6 +140,8 @@ int Kirb_parse_all(int argc, char **argv,
                 {
                     if(kirbparse_debug)
                         fprintf(kirbparse_err, "ERROR: KIRBPARSE: Parse Error: value option missing value\n");
+                    if(marks != stack_marks)
+                        free(marks);
                     return 1;
                 }
             }
@@ -165,7 +164,7 @@ int Kirb_parse_all(int argc, char **argv,
                 if(kirbparse_debug)
                     fprintf(kirbparse_info, "INFO: KIRBPARSE: Found long value option at %s\n", argv[i]);
 
-                if(marks[i + 1] == 3)
+                if(i + 1 < argc && marks[i + 1] == 3)
                 {
                     // Add value to output list
                     *(values_out + v) = argv[++i]; // add and skip the value
@@ -177,6 +176,8 @@ int Kirb_parse_all(int argc, char **argv,
                 {
                     if(kirbparse_debug)
                         fprintf(kirbparse_err, "ERROR: KIRBPARSE: Parse Error: value option missing value\n");
+                    if(marks != stack_marks)
+                        free(marks);
                     return 1;
                 }
             }
@@ -184,13 +185,21 @@ int Kirb_parse_all(int argc, char **argv,
     }
     // Pick up all the anonymous values
     *anon_out = malloc(mark_ret * sizeof(char*));
+    if(*anon_out == NULL && mark_ret > 0)
+    {
+        if(kirbparse_debug)
+            fprintf(kirbparse_err, "ERROR: KIRBPARSE: Parse Error: Out of memory for %d anonymous values\n", mark_ret);
+        if(marks != stack_marks)
+            free(marks);
+        return -1;
+    }
     *num_anon = mark_ret;
     int place_in_anon = 0;
     for(int i = 1; i < argc; ++i)
     {
         if(marks[i] == 4) // An anonymous value
         {
-            *(anon_out + place_in_anon) = (argv+i); // Reference in the output
+            (*anon_out)[place_in_anon] = argv[i]; // Reference in the output
             ++place_in_anon;
 
             if(kirbparse_debug)
@@ -200,6 +209,8 @@ int Kirb_parse_all(int argc, char **argv,
     if(kirbparse_debug)
         fprintf(kirbparse_info, "INFO: KIRBPARSE: End Parse phase\n");
 
+    if(marks != stack_marks)
+        free(marks);
     return 0;
 }
 
@@ -323,33 +334,87 @@ int Kirb_mark(int argc, char **argv,
     // Sequentially mark the arguments
     for(int i = 1; i < argc; ++i)
     {
-        // If it starts with a -, it's an option
-        if(argv[i][0] == '-')
-        {
-            // If it has a second dash, it's a long option
-            if(argv[i][1] == '-')
-                *(marks + i) = OPTION_LONG;
-            else
-                *(marks + i) = OPTION_SHORT;
-        }
-        // If not preceded by a value option, it's anonymous
-        else if(match_long(num_value_opts, value_opts_long, argv[i - 1]) == -1 &&
-                match_short(num_value_opts, value_opts, argv[i - 1]) == -1)
-        {
+        *(marks + i) = mark_one(argv, i, num_value_opts, value_opts, value_opts_long);
+        if(marks[i] == ANONYMOUS)
             ++num_anon;
-            *(marks + i) = ANONYMOUS;
+    }
+    return num_anon;
+}
+
+int Kirb_mark_compact(int argc, char **argv,
+                      int num_value_opts, char *value_opts, char **value_opts_long,
+                      uint8_t *marks)
+{
+    int num_anon = 0;
+
+    if(marks == NULL)
+    {
+        if(kirbparse_debug)
+            fprintf(kirbparse_err, "KIRBPARSE: ERROR: Mark phase array is uninitialized\n");
+        return -1;
+    }
+    marks[0] = PROGRAM;
+
+    for(int i = 1; i < argc; ++i)
+    {
+        marks[i] = (uint8_t) mark_one(argv, i, num_value_opts, value_opts, value_opts_long);
+        if(marks[i] == ANONYMOUS)
+            ++num_anon;
+    }
+    return num_anon;
+}
+
+// Make sure the logging files are usable before parsing, defaulting kirbparse_err to stderr
+int kirb_check_sinks(void)
+{
+    if(kirbparse_info == NULL)
+    {
+        fprintf(kirbparse_err == NULL ? stderr : kirbparse_err,
+                "KIRBPARSE ERROR: information logging file not specified. "
+                        "If this is intended, set kirbparse_info to stdout.\n");
+        return -1;
+    }
+    if(kirbparse_err == NULL)
+    {
+        if(kirbparse_werror)
+        {
+            fprintf(stderr, "ERROR: KIRBPARSE: error logging file not specified. "
+                            "If this is intended, set kirbparse_err to stderr.\n");
+            return -1;
         }
+
+        fprintf(kirbparse_info, "WARN: KIRBPARSE: error logging file not specified. "
+                                "Will automatically be set to stderr.\n");
+        kirbparse_err = stderr;
+    }
+    return 0;
+}
+
+// Mark for argv[i], i > 0
+static enum Mark mark_one(char **argv, int i, int num_value_opts, char *value_opts, char **value_opts_long)
+{
+    // If it starts with a -, it's an option
+    if(argv[i][0] == '-')
+    {
+        // If it has a second dash, it's a long option
+        if(argv[i][1] == '-')
+            return OPTION_LONG;
         else
-            *(marks + i) = VALUE;
+            return OPTION_SHORT;
     }
-    return num_anon;
+    // If not preceded by a value option, it's anonymous
+    else if(match_long(num_value_opts, value_opts_long, argv[i - 1]) == -1 &&
+            match_short(num_value_opts, value_opts, argv[i - 1]) == -1)
+        return ANONYMOUS;
+    else
+        return VALUE;
 }
 
 // Look for crossover (-v and --verbose both present) and duplicates (-v -v or --verbose --verbose)
 static int crossover_check(int argc, char **argv, char opt, char *long_opt)
 {
     char opt_str[] = { '-', opt, '\0'};
-    char long_str[strlen(long_opt) + 2]; // option plus dash and null char
+    char long_str[strlen(long_opt) + 3]; // option plus dashes and null char
     strcpy(long_str, dash_string);
     strcat(long_str, long_opt);
     int opt_present = 0, long_present = 0;
@@ -372,7 +437,7 @@ static int crossover_check(int argc, char **argv, char opt, char *long_opt)
 // Returns index in opts of the matched arg
 static int match_short(int num_opts, char *opts, char *arg)
 {
-    if(strlen(arg) == 2) // arg is just a dash and a character, so a short option
+    if(arg[0] == '-' && strlen(arg) == 2) // arg is just a dash and a character, so a short option
     {
         for(int i = 0; i < num_opts; ++i)
         {
@@ -387,10 +452,13 @@ static int match_short(int num_opts, char *opts, char *arg)
 // Returns index in long_opts of the matched arg
 static int match_long(int num_long_opts, char **long_opts, char *arg)
 {
-    char *arg_minus_dash = arg + 1;
+    if(arg[0] != '-' || arg[1] != '-')
+        return -1; // Not a long option
+
+    char *arg_minus_dashes = arg + 2;
     for(int i = 0; i < num_long_opts; ++i)
     {
-        if(strcmp(long_opts[i], arg_minus_dash) == 0)
+        if(strcmp(long_opts[i], arg_minus_dashes) == 0)
             return i; // Index in long_opts that matched arg
     }
 
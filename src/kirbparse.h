@@ -24,10 +24,152 @@
  * values_out: array strings. Assumed to be the same length as value_opts!!
  * num_anon: will contain number of returned anonymous values so you can traverse anon_out.
  * anon_out: pointer able to store a value of size sizeof(char**). ex: ./myprogram hello.c -o hello will have num_anon 1 and *anon_out [["hello.c"]]
+     *anon_out is allocated by the library, free it with Kirb_free_anon when you're done with the anonymous values
+ *
+ * COMPILED RULES
+ * Kirb_compile takes the same rule lists (and does the same inference) as Kirb_prep, and builds a KirbTable that can
+ *  be reused for any number of parses. Short options are looked up by character in a 256-entry array and long
+ *  options through a hash of their names, so a lookup no longer depends on how many rules you have.
+ *  The *_table functions behave exactly like their uncompiled counterparts. Free the table with Kirb_free_table.
+ * Long names are hashed from their length and first and last 16 bytes, and compared with strcmp. SSE2 and AVX2
+ *  kernels that compare 16 or 32 bytes at a time are there to opt into, since neither beats the scalar one on
+ *  KirbBench yet: set KIRBPARSE_SIMD to sse2 or avx2 in the environment, or switch kernels with Kirb_simd_use
+ *  between parses (Kirb_simd_kernel says which is in use).
+ * Kirb_parse_fused does prep, marking and parsing while visiting each argument once. It returns the same codes as
+ *  Kirb_parse_table, but won't print the per-option debug messages.
+ *
+ * PRECOMPILED RULES
+ * A compiled table only refers to itself by index, so Kirb_save_table (or Kirb_write_table) can store it as a
+ *  blob and Kirb_load_table (or Kirb_map_table) use it again, in another process, without redoing inference,
+ *  hashing or building the trie. Loading only checks the blob and points the table into it, nothing is copied.
+ *  The KirbGen tool compiles rules given on its command line into a blob, written out as a C array to build into
+ *  your program, and the kirbparse_rules CMake function runs it at build time. A blob starts with a magic number,
+ *  KIRB_BLOB_VERSION, the sizes and byte order it was written with, and a checksum, and anything stale or damaged
+ *  is refused. Blobs aren't a safe format for rules from someone you don't trust.
+ *
+ * CONTEXTS
+ * The kirbparse_* globals are shared by every parse in the program, and Kirb_parse_all will even set kirbparse_err
+ *  for you. If you parse from more than one thread, put the settings and the compiled rules in a KirbContext
+ *  instead and use the _ctx functions, which only ever read the context they are given.
+ * Allocation happens through the context's alloc and release (malloc and free by default), and for the *anon_out
+ *  list only. Kirb_parse_arena doesn't allocate at all: it lays the flags, values and anonymous values out in a
+ *  buffer you supply, so a parse can live entirely on your stack.
+ * Kirb_parse_batch runs a whole array of command lines through one context on a pool of threads. Workers that run
+ *  out of their own share of the items take over items from the busier ones.
+ * For one command line in the millions of arguments, Kirb_mark_parallel splits argv into a chunk per thread. An
+ *  argument's mark only depends on the one before it, so the chunks need no fixing up afterwards and the result is
+ *  exactly Kirb_mark's.
+ *
+ * RESPONSE FILES
+ * Kirb_expand replaces every @file argument (after the program name) with the arguments in that file, the way gcc
+ *  does, so command lines too long for the OS can still come through. Files are mapped privately and split where
+ *  they lie, so the arguments, and any values or anonymous values parsed out of them, point into the mapping.
+ *  Nothing is allocated per argument. An @file that can't be opened is left as it is, and so is one nested more
+ *  than KIRB_RESPONSE_DEPTH files deep or naming a file it's already inside of. Reading more than
+ *  KIRB_RESPONSE_FILES files in all, or expanding to more than INT_MAX arguments, is an error (-1).
+ *  Keep the KirbArgs until you're done with the results, then Kirb_free_args.
+ *
+ * STREAMING
+ * When the arguments come in pieces (a pipe, a response file read a chunk at a time), Kirb_stream_open a stream and
+ *  Kirb_stream_push each piece, the program name first. Flags and values land in your flags_out and values_out as
+ *  they're found, and each anonymous value goes to your callback on the spot instead of into a list, so memory stays
+ *  the same however many arguments go through. Value strings must outlive the stream, anonymous ones only the call.
+ *  Kirb_stream_end then gives Kirb_parse_all_ctx's verdict. Crossovers and duplicates can only be judged at the end,
+ *  by which point the callback has already seen the anonymous values, so check the result before acting on them.
+ *
+ * EXTENDED SYNTAX
+ * Kirb_parse_extended also accepts what the other parses leave alone: --name=value, values stuck to their short
+ *  option (-Iinclude, -j8), and long names cut short to any prefix only one of them starts with (--verb for
+ *  --verbose). Each argument is resolved in one scan, through the 256-entry short array or down the prefix trie
+ *  Kirb_compile builds over the long names. Attached values point into argv just past the = or the option
+ *  character, nothing is copied. Whole option names behave exactly as in Kirb_parse_all_ctx, and a name that is a
+ *  prefix of longer ones still means itself. An abbreviation more than one name starts with, or a flag given a
+ *  value with =, is a user error.
+ *
+ * FLAG BITSETS
+ * Kirb_parse_bits is Kirb_parse_all_ctx with the flags packed one bit each into KIRB_FLAG_WORDS(num_flags) uint64_t
+ *  words, flag i being bit i % 64 of word i / 64. Build a mask of several flags with Kirb_flag_mask and ask whether
+ *  any, all or none of them are set a word at a time with Kirb_flags_any, Kirb_flags_all and Kirb_flags_none.
+ *  Pairs of flags that shouldn't be given together (say --quiet and --verbose) are declared with the rest of the
+ *  rules, as flat {a, b, a, b, ...} index pairs in the context's conflicts, and Kirb_flags_conflicts says which of
+ *  them a parse broke.
+ *
+ * TYPED VALUES
+ * Kirb_parse_typed converts each value as it's parsed, by the type you give each value option: int64, uint64,
+ *  double, bool (true/false, yes/no, on/off, 1/0, any case), a size in bytes (512, 64K, 1.5GiB, 10mb, all powers
+ *  of 1024), a duration in nanoseconds (250ms, 1.5s, 1h30m, with units ns, us, ms, s, m, h and d) or one of a list
+ *  of choices. Numbers are always decimal with a '.' point whatever the locale, and digits are read eight at a
+ *  time. Each KirbTyped says how its value came out: missing, empty, malformed, out of range, with a unit that
+ *  isn't one, or not among the choices, and keeps the text so you can say which. Any of those is a user error,
+ *  after every value has been converted. Kirb_convert converts a single string the same way.
+ *
+ * MULTIPLE VALUES
+ * Kirb_parse_multi lets each value option turn up as many times as its max_values entry allows (-I a -I b
+ *  --include c), and keeps every value instead of only the last. They come back compressed sparse row style: the
+ *  argv indices of all the values in one flat array, grouped by option, and an offsets array saying where each
+ *  option's group starts. Option v's values are argv[indices[offsets[v]]] up to (not including)
+ *  argv[indices[offsets[v + 1]]], in command line order. Both arrays are yours, so extracting the values allocates
+ *  nothing. Value options may be repeated and mix their short and long forms, flags are checked as usual.
+ *  An option whose per_use entry is above 1 takes up to that many values each time it's given (-I a b c), stopping
+ *  early at the next dashed argument, so arguments that would otherwise be anonymous become its values. Pass NULL
+ *  for per_use to take one value each time. Going over an option's maximum is a user error.
+ *
+ * SUBCOMMANDS
+ * For tools in the style of git, list each subcommand's name and rules in a KirbCommand and register them all
+ *  against the global context with Kirb_commands_create. Kirb_parse_global parses the global options up to the
+ *  first anonymous value, looks that up among the subcommand names by hash, and says where the subcommand's
+ *  arguments start. Kirb_parse_command carries on from there with the subcommand's rules, its name standing in for
+ *  the program name, so nothing before it is scanned again. A subcommand's rules are only compiled the first time
+ *  it's parsed (or Kirb_command_context asks for them), so adding subcommands costs next to nothing at startup.
+ *  Subcommands parse with the global context's settings. Inference happens when registering, and the rule lists
+ *  must outlive the registry. A registry may be shared between threads.
+ *
+ * COMPLETION
+ * Kirb_complete answers a shell's tab key in microseconds, from the same rules the parse uses. Give it the words up
+ *  to and including the one under the cursor (empty if nothing's typed yet). That word is marked the way Kirb_mark
+ *  would mark it: an option, the value of a value option or an anonymous value. An option is completed to every
+ *  long name it starts, read in sorted order off the trie Kirb_compile builds. A lone - also lists the short
+ *  options. A value is completed from its option's choices, if you pass the types you gave Kirb_parse_typed.
+ *  Matches are written one per line into your buffer.
+ * Kirb_completion_script prints a bash, zsh or fish stub that runs `program __complete words...` on each keypress,
+ *  with program quoted for that shell so any path is run as it is.
+ *  When argv[1] is KIRB_COMPLETE_COMMAND, call Kirb_complete(argc - 1, argv + 1, ...), print the buffer and exit.
+ *  Where there's nothing to offer, the stubs fall back on the shell's file name completion.
+ *
+ * LAYERED SOURCES
+ * Settings often come from more places than the command line. Kirb_layers_create stacks, lowest first: defaults
+ *  you pass in, a config file, environment variables with a prefix, and then argv, which Kirb_parse_layered parses
+ *  as Kirb_parse_all_ctx would. Whatever argv doesn't set is taken from the highest layer that does, into the same
+ *  flags_out and values_out, and each result's KIRB_ORIGIN says which layer it came from.
+ * The config file has a name = value line per setting, the name being a long option. Blank lines and lines
+ *  starting with # or ; are skipped, quotes around a value are dropped, and later lines win. The environment
+ *  variable for --dry-run with the prefix TOOL_ is TOOL_DRY_RUN. A flag's setting is 1, true, yes or on, or 0,
+ *  false, no, off or empty to turn it off (a flag on its own line in the file turns it on). A setting that isn't one
+ *  of ours, or a flag set to anything else, is a user error, except that other variables with the prefix are
+ *  left alone. The file is mapped and parsed in place, and the environment is scanned once a parse.
+ * With the cache on, the file is only loaded again when its size or modification time changes (on Windows it's
+ *  read every time). Values from the file last until it's loaded again or the layers are freed, those from the
+ *  environment until it changes. Layers aren't thread safe.
+ *
+ * LAZY PARSING
+ * If you only need an answer or two (is --help there?), Kirb_open a handle instead of parsing everything. Kirb_get_flag,
+ *  Kirb_get_value and Kirb_next_anon resolve the arguments from the front only until they can answer, and remember
+ *  what they've seen for the next question. An answer near the front of a huge argv stays cheap.
+ *  Duplicates and crossovers can be anywhere, so only Kirb_finish, which goes through the rest, confirms the answers
+ *  the way Kirb_parse_all_ctx would. A handle isn't thread safe, and free it with Kirb_close.
+ *
+ * STATS AND TRACES
+ * Point a context's stats at a KirbStats and the _ctx functions add their timings and counts to it. Without one the
+ *  parse runs code with the counting compiled out, so it costs nothing.
+ * With debug on, the _ctx functions print the same messages as the globals would. Give the context a KirbTrace and
+ *  they are queued there instead, to be printed by Kirb_trace_drain whenever (and on whichever thread) suits you.
+ *  A trace takes one writer and one reader at a time, and holds pointers into argv, so drain it before argv goes.
+ *  Contexts with stats or a trace belong to one thread, Kirb_parse_batch leaves both alone.
  *
  * RETURN CODES
  * Special case: my matching helper functions will return an index as opposed to a return code or -1 if not found
- * -1: (error) The programmer did something wrong
+ * -2: (error) A buffer the programmer supplied was too small (see Kirb_parse_arena)
+ * -1: (error) The programmer did something wrong, or an allocation failed (said as much under debug)
  *  1: (error) The user did something wrong (and you probably want to display your usage or help message)
  *  2: (warning) Somebody did something wrong, but it's not worth worrying about
  */
@@ -38,6 +180,8 @@ extern "C"
 #endif
 
 #include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
 
 //#include <stdarg.h>
 #ifndef KIRBPARSE_LIBRARY_H
@@ -49,9 +193,117 @@ extern FILE *kirbparse_err;  // Where to print errors, REQUIRED
 extern int kirbparse_debug;  // Write helpful info and error messages to the supplied files alongside returning error codes
 extern int kirbparse_werror; // Treat warning codes (say, a flag was included twice) as errors
 
-// Enumeration for marking
+// Enumeration for marking, the _compact functions store these in a single byte
 enum Mark { PROGRAM = 0, OPTION_SHORT = 1, OPTION_LONG = 2, VALUE = 3, ANONYMOUS = 4 };
 
+// Hashed long option, see KirbTable
+struct KirbSlot
+{
+    unsigned int hash; // Hash of the long name
+    int name;          // Offset of the long name in the name pool, -1 if the slot is empty
+    int flag;          // First flag with this long name, -1 if none
+    int value;         // First value option with this long name, -1 if none
+};
+
+// Node of the prefix trie over the long names, see KirbTable
+struct KirbNode
+{
+    int children;     // Index of the first child node, the rest follow it
+    int num_children;
+    int exact;        // Slot of the long name ending here, -1 if none
+    int unique;       // Slot of the only long name at or below here, -1 if there's more than one
+};
+
+// Compiled rules, see Kirb_compile
+// Everything lives in one allocation (block) and refers to itself by index, never by pointer
+typedef struct KirbTable
+{
+    int num_flags;
+    int num_value_opts;
+    int num_slots;           // Always a power of two, at least twice the number of long names
+    int names_size;          // Bytes used in the name pool
+    int *short_flag;         // 256 entries: first flag index for each short character, -1 if none
+    int *short_value;        // 256 entries: first value option index for each short character, -1 if none
+    struct KirbSlot *slots;  // Open addressed hash of the long names
+    int *flag_slot;          // Slot holding each flag's long name
+    int *value_slot;         // Slot holding each value option's long name
+    char *flag_short;        // Short form of each flag, after inference
+    char *value_short;       // Short form of each value option, after inference
+    char *names;             // Pool of NUL terminated long names, each zero padded to a multiple of 32 bytes
+    int num_nodes;
+    struct KirbNode *nodes;  // Prefix trie of the long names, node 0 is the root
+    unsigned char *labels;   // Character leading into each node
+    void *block;
+    size_t block_size;       // Bytes of block in use, what Kirb_save_table copies
+    int source;              // Whether block was compiled, loaded from a blob or mapped from a file
+} KirbTable;
+
+// Counters added to by the _ctx functions, see KirbContext.stats
+// The fused parse does everything in its parse time, prep_ns and mark_ns only grow through Kirb_prep_ctx and
+//  Kirb_mark_ctx
+typedef struct KirbStats
+{
+    uint64_t prep_ns;
+    uint64_t mark_ns;
+    uint64_t parse_ns;
+    uint64_t visits;     // Arguments looked at, once per phase that looks
+    uint64_t matches;    // Times an argument was matched against the rules (a table index or a hash probe each)
+    uint64_t shorts;     // Arguments marked OPTION_SHORT
+    uint64_t longs;      // Arguments marked OPTION_LONG
+    uint64_t values;     // Arguments marked VALUE
+    uint64_t anonymous;  // Arguments marked ANONYMOUS
+    uint64_t duplicates; // Options given more than once in the same form
+    uint64_t crossovers; // Options given in both their short and long form
+} KirbStats;
+
+// What a trace message is about, see KirbEvent
+enum KirbEventCode
+{
+    EVENT_BEGIN_CROSSOVER, EVENT_END_CROSSOVER, EVENT_CROSSOVER, EVENT_DUPLICATE_FLAG, EVENT_DUPLICATE_FLAG_ERROR,
+    EVENT_DUPLICATE_VALUE, EVENT_FOUND_FLAG, EVENT_FOUND_VALUE, EVENT_MISSING_VALUE, EVENT_PREP_ERROR,
+    EVENT_NO_MARKS, EVENT_ANON_NOT_NULL, EVENT_AMBIGUOUS_OPTION, EVENT_FLAG_WITH_VALUE,
+    EVENT_TOO_MANY_VALUES, EVENT_BAD_VALUE, EVENT_UNKNOWN_COMMAND, EVENT_BAD_SETTING
+};
+
+// One queued trace message
+typedef struct KirbEvent
+{
+    int code;        // enum KirbEventCode
+    int position;    // Index in argv, -1 if the message isn't about an argument
+    const char *arg; // argv[position], NULL if the message isn't about an argument
+} KirbEvent;
+
+// Lock-free queue of trace messages, see Kirb_trace_create
+typedef struct KirbTrace KirbTrace;
+
+// Everything a parse needs, so separate threads can parse at once without the globals above, see Kirb_context_init
+// The _ctx functions only read from it, so one context can also be shared between threads
+typedef struct KirbContext
+{
+    FILE *info;          // Where to print warnings, REQUIRED
+    FILE *err;           // Where to print errors, stderr if NULL
+    int debug;           // Same as kirbparse_debug
+    int werror;          // Same as kirbparse_werror
+    int allow_crossover; // Same as the allow_crossover argument of Kirb_prep
+    void *(*alloc)(size_t size, void *user); // Used for all of the parse's allocations, malloc if NULL
+    void (*release)(void *ptr, void *user);  // Frees what alloc returned, free if NULL
+    void *alloc_user;                        // Passed through to alloc and release
+    KirbStats *stats;    // Added to by every parse if not NULL
+    KirbTrace *trace;    // Where debug messages are queued if not NULL, otherwise they're printed right away
+    const int *conflicts; // Flat {a, b, a, b, ...} pairs of flags not to be given together, see FLAG BITSETS
+    int num_conflicts;    // Pairs in conflicts
+    KirbTable table;
+} KirbContext;
+
+// Results carved out of the caller's buffer by Kirb_parse_arena
+typedef struct KirbResult
+{
+    int *flags;     // Same as flags_out
+    char **values;  // Same as values_out
+    int num_anon;
+    char **anon;    // Same as *anon_out
+} KirbResult;
+
 // Preparation phase
 int Kirb_prep(int argc, char **argv,
               int num_flags, char *flags, char **flags_long,
@@ -63,12 +315,292 @@ int Kirb_mark(int argc, char **argv, // Args
               int num_value_opts, char *value_opts, char **value_opts_long, // Value opts for anonymity detection
               enum Mark *marks); // Output, marks should be the same length as argv!!
 
+// Marking phase with one byte per argument, each holding an enum Mark
+int Kirb_mark_compact(int argc, char **argv,
+                      int num_value_opts, char *value_opts, char **value_opts_long,
+                      uint8_t *marks); // Output, marks should be the same length as argv!!
+
 // With all options
 int Kirb_parse_all(int argc, char **argv,  // String to parse
                 int num_flags, char *flags, char **flags_long, int infer, int allow_crossover, // Flag options
                 int num_value_opts, char *value_opts, char **value_opts_long, // Value options, see documentation
                 int *flags_out, char **values_out, int *num_anon, char ***anon_out); // Outputs
 
+// Compile rule lists into a reusable table, infer works the same as in Kirb_prep
+int Kirb_compile(KirbTable *table,
+                 int num_flags, char *flags, char **flags_long,
+                 int num_value_opts, char *value_opts, char **value_opts_long,
+                 int infer);
+void Kirb_free_table(KirbTable *table);
+// "avx2", "sse2" or "scalar", the kernel compiled tables look long names up with
+const char *Kirb_simd_kernel(void);
+// Switch to the named kernel, -1 if this CPU or build doesn't have it. Not while another thread is parsing
+int Kirb_simd_use(const char *kernel);
+
+// Changes whenever a table's block or its hash does, so older blobs are refused, see PRECOMPILED RULES
+#define KIRB_BLOB_VERSION 1
+
+// Bytes Kirb_save_table needs for table
+size_t Kirb_table_blob_size(const KirbTable *table);
+// Save table into blob, -2 if blob_size is smaller than Kirb_table_blob_size
+int Kirb_save_table(const KirbTable *table, void *blob, size_t blob_size); // Output
+// Use blob (8-byte aligned) as table without copying it, -1 if it isn't a blob or is stale or damaged
+// The blob must outlive the table, Kirb_free_table leaves it alone
+int Kirb_load_table(KirbTable *table, const void *blob, size_t blob_size); // Output
+// Save table to the file at path, or map a file written that way into table (Kirb_free_table unmaps it)
+int Kirb_write_table(const KirbTable *table, const char *path);
+int Kirb_map_table(KirbTable *table, const char *path); // Output
+
+// Compiled counterparts of the three phases
+int Kirb_prep_table(int argc, char **argv, const KirbTable *table, int allow_crossover);
+int Kirb_mark_table(int argc, char **argv, const KirbTable *table, enum Mark *marks);
+int Kirb_parse_table(int argc, char **argv, const KirbTable *table, int allow_crossover,
+                     int *flags_out, char **values_out, int *num_anon, char ***anon_out); // Outputs
+
+// Set up a context with debug and werror off, no stats or trace, and the rules compiled, see Kirb_compile
+int Kirb_context_init(KirbContext *ctx, FILE *info, FILE *err,
+                      int num_flags, char *flags, char **flags_long,
+                      int num_value_opts, char *value_opts, char **value_opts_long,
+                      int infer, int allow_crossover);
+// Kirb_context_init with the rules loaded from a blob instead, see Kirb_load_table
+int Kirb_context_load(KirbContext *ctx, FILE *info, FILE *err, const void *blob, size_t blob_size,
+                      int allow_crossover);
+void Kirb_context_free(KirbContext *ctx);
+
+// Re-entrant phases, these never touch the globals
+int Kirb_prep_ctx(int argc, char **argv, const KirbContext *ctx);
+int Kirb_mark_ctx(int argc, char **argv, const KirbContext *ctx, enum Mark *marks);
+int Kirb_mark_compact_ctx(int argc, char **argv, const KirbContext *ctx, uint8_t *marks);
+int Kirb_parse_all_ctx(int argc, char **argv, const KirbContext *ctx,
+                       int *flags_out, char **values_out, int *num_anon, char ***anon_out); // Outputs
+
+// Kirb_parse_all_ctx, also taking --name=value, -Xvalue and unique abbreviations of long names
+int Kirb_parse_extended(int argc, char **argv, const KirbContext *ctx,
+                        int *flags_out, char **values_out, int *num_anon, char ***anon_out); // Outputs
+
+// Words in a flag bitset holding num_flags flags
+#define KIRB_FLAG_WORDS(num_flags) (((num_flags) + 63) / 64)
+
+// Kirb_parse_all_ctx with the flags as a bitset, see FLAG BITSETS
+int Kirb_parse_bits(int argc, char **argv, const KirbContext *ctx,
+                    uint64_t *flag_bits, char **values_out, int *num_anon, char ***anon_out); // Outputs
+
+// Set mask to the count flags listed, returns -1 if one of them isn't below num_flags
+int Kirb_flag_mask(uint64_t *mask, int num_flags, const int *flags, int count);
+// Whether any, all or none of the flags in mask are set in bits, both num_flags flags long
+int Kirb_flags_any(const uint64_t *bits, const uint64_t *mask, int num_flags);
+int Kirb_flags_all(const uint64_t *bits, const uint64_t *mask, int num_flags);
+int Kirb_flags_none(const uint64_t *bits, const uint64_t *mask, int num_flags);
+// How many of ctx's conflicting pairs of flags have both set in bits (their pair numbers go in found if it isn't
+//  NULL), -1 if a pair names a flag ctx doesn't have
+int Kirb_flags_conflicts(const uint64_t *bits, const KirbContext *ctx, int *found); // Output
+
+// What a value option's value is converted to, see TYPED VALUES
+enum KirbKind { KIRB_STRING = 0, KIRB_INT64, KIRB_UINT64, KIRB_DOUBLE, KIRB_BOOL, KIRB_SIZE, KIRB_DURATION, KIRB_CHOICE };
+// How a typed value came out, anything past KIRB_VALUE_ABSENT is the user's mistake
+enum KirbValueStatus
+{
+    KIRB_VALUE_OK = 0, KIRB_VALUE_ABSENT, KIRB_VALUE_EMPTY, KIRB_VALUE_MALFORMED, KIRB_VALUE_RANGE, KIRB_VALUE_UNIT,
+    KIRB_VALUE_CHOICE
+};
+
+// Type of one value option
+typedef struct KirbType
+{
+    int kind;             // enum KirbKind
+    const char **choices; // KIRB_CHOICE only: the values accepted
+    int num_choices;
+} KirbType;
+
+// One converted value
+typedef struct KirbTyped
+{
+    union
+    {
+        int64_t i;     // KIRB_INT64, KIRB_DURATION (nanoseconds) and KIRB_CHOICE (index into choices)
+        uint64_t u;    // KIRB_UINT64 and KIRB_SIZE (bytes)
+        double d;      // KIRB_DOUBLE
+        int b;         // KIRB_BOOL
+        const char *s; // KIRB_STRING
+    } as;
+    const char *text;  // The value as given, NULL if the option wasn't
+    int status;        // enum KirbValueStatus
+} KirbTyped;
+
+// Kirb_parse_all_ctx with each value converted to its types[v], see TYPED VALUES
+int Kirb_parse_typed(int argc, char **argv, const KirbContext *ctx, const KirbType *types,
+                     int *flags_out, KirbTyped *typed_out, int *num_anon, char ***anon_out); // Outputs
+// Convert one value (NULL for a missing one), returns its status or -1 if type is unusable
+int Kirb_convert(const char *text, const KirbType *type, KirbTyped *out); // Output
+
+// First argument of the command line the completion scripts run, see COMPLETION
+#define KIRB_COMPLETE_COMMAND "__complete"
+
+// Complete argv[argc - 1] into out, a line per match, and set *num_matches. The word's mark goes in *mark and, if
+//  it's a value, its value option in *value_opt (either may be NULL). types is NULL or as for Kirb_parse_typed
+// Returns -2 if out_size runs out, keeping the matches that fit
+int Kirb_complete(int argc, char **argv, const KirbContext *ctx, const KirbType *types,
+                  char *out, size_t out_size, int *num_matches, enum Mark *mark, int *value_opt); // Outputs
+// Print the completion script for shell ("bash", "zsh" or "fish") that calls back into program
+int Kirb_completion_script(FILE *out, const char *shell, const char *program);
+
+// Where a layered result came from, see LAYERED SOURCES
+enum KirbOrigin
+{
+    KIRB_ORIGIN_NONE = 0, KIRB_ORIGIN_DEFAULT, KIRB_ORIGIN_CONFIG, KIRB_ORIGIN_ENV, KIRB_ORIGIN_ARGV
+};
+
+// Defaults, config file and environment under a context's rules, see Kirb_layers_create
+typedef struct KirbLayers KirbLayers;
+
+// Layer default_flags and default_values (either may be NULL), the file at config_path and the variables starting
+//  with env_prefix (either NULL for none) under ctx's rules. cache keeps an unchanged config file loaded
+// ctx and the defaults' strings must outlive the layers, NULL if allocation failed
+KirbLayers *Kirb_layers_create(const KirbContext *ctx, const int *default_flags, char **default_values,
+                               const char *config_path, const char *env_prefix, int cache);
+void Kirb_layers_free(KirbLayers *layers);
+// Kirb_parse_all_ctx with whatever argv doesn't set filled in from the layers below it. flag_origins and
+//  value_origins (either may be NULL) get each result's enum KirbOrigin. A bad setting is a user error
+int Kirb_parse_layered(int argc, char **argv, KirbLayers *layers, int *flags_out, char **values_out,
+                       int *flag_origins, int *value_origins, int *num_anon, char ***anon_out); // Outputs
+
+// Kirb_parse_all_ctx with up to max_values[v] (at least 1) values for each value option v, and up to per_use[v]
+//  (at least 1, or NULL for 1) values each time it's given, see MULTIPLE VALUES
+// offsets holds num_value_opts + 1 ints and indices as many as max_values adds up to, which must fit in an int
+int Kirb_parse_multi(int argc, char **argv, const KirbContext *ctx, const int *max_values, const int *per_use,
+                     int *flags_out, int *offsets, int *indices, int *num_anon, char ***anon_out); // Outputs
+
+// One subcommand's rules, the same as Kirb_context_init takes them, see SUBCOMMANDS
+typedef struct KirbCommand
+{
+    const char *name;
+    int num_flags;
+    char *flags;
+    char **flags_long;
+    int num_value_opts;
+    char *value_opts;
+    char **value_opts_long;
+    int infer;
+} KirbCommand;
+
+// Registered subcommands, see Kirb_commands_create
+typedef struct KirbCommands KirbCommands;
+
+// Register num_commands subcommands under ctx's global rules, NULL if a name is missing or repeated, a rule list
+//  is unusable or allocation failed. ctx must outlive the registry
+KirbCommands *Kirb_commands_create(const KirbContext *ctx, const KirbCommand *commands, int num_commands);
+void Kirb_commands_free(KirbCommands *commands);
+// Index of the subcommand called name, -1 if there isn't one
+int Kirb_find_command(const KirbCommands *commands, const char *name);
+// Context the subcommand parses with, compiled on first use. NULL if command is out of range or compiling failed
+const KirbContext *Kirb_command_context(KirbCommands *commands, int command);
+// Parse the global options into flags_out and values_out, stopping at the first anonymous value. Its subcommand's
+//  index goes in *command (-1 if no subcommand was given) and where the subcommand's arguments start in *next
+// An unknown subcommand is a user error
+int Kirb_parse_global(int argc, char **argv, KirbCommands *commands,
+                      int *flags_out, char **values_out, int *command, int *next); // Outputs
+// Parse argv from next on with the subcommand's rules, as Kirb_parse_all_ctx would
+int Kirb_parse_command(int argc, char **argv, KirbCommands *commands, int command, int next,
+                       int *flags_out, char **values_out, int *num_anon, char ***anon_out); // Outputs
+
+// Kirb_parse_all_ctx without any allocation, every result is stored in the arena_size bytes at arena
+// Returns -2 if the arena runs out of room, Kirb_arena_size(argc, ctx) bytes is always enough
+int Kirb_parse_arena(int argc, char **argv, const KirbContext *ctx, void *arena, size_t arena_size,
+                     KirbResult *result); // Output
+size_t Kirb_arena_size(int argc, const KirbContext *ctx); // 0 for an unusable context or argc below 1
+
+// Free *anon_out after a parse, ctx is the context it was parsed with or NULL if there wasn't one
+void Kirb_free_anon(const KirbContext *ctx, char **anon);
+
+// Arguments pushed piece by piece, see Kirb_stream_open
+typedef struct KirbStream KirbStream;
+// Called with each anonymous value and its position in the whole command line
+typedef void (*KirbAnonFn)(char *anon, int position, void *user);
+
+// Start a stream parsing into flags_out and values_out (cleared here), NULL if an argument is unusable or allocation
+//  failed
+KirbStream *Kirb_stream_open(const KirbContext *ctx, int *flags_out, char **values_out,
+                             KirbAnonFn on_anon, void *user);
+// Parse the next argc arguments. Returns 1 once a value option has gone without its value, after which arguments
+//  are only checked for crossovers
+int Kirb_stream_push(KirbStream *stream, int argc, char **argv);
+// Finish the command line, returning what Kirb_parse_all_ctx would have
+int Kirb_stream_end(KirbStream *stream);
+void Kirb_stream_close(KirbStream *stream);
+
+// argv with the response files expanded, see Kirb_expand
+typedef struct KirbArgs
+{
+    int argc;
+    char **argv;     // NUL terminated arguments, pointing into the original argv or the mapped files
+    size_t *lengths; // Length of each argument
+    void *block;     // Where argv, lengths and the file mappings live
+} KirbArgs;
+
+// Response files may name more response files, this deep and no deeper
+#define KIRB_RESPONSE_DEPTH 16
+// Most response files one Kirb_expand reads, however they're nested, the same limit as libiberty's expandargv
+#define KIRB_RESPONSE_FILES 2000
+
+// Expand @file arguments, allocating through ctx (or malloc/free if it's NULL)
+// Files hold arguments separated by whitespace, with 'single' and "double" quotes and backslash escapes
+int Kirb_expand(int argc, char **argv, const KirbContext *ctx, KirbArgs *args); // Output
+void Kirb_free_args(const KirbContext *ctx, KirbArgs *args);
+
+// Arguments resolved on demand, see Kirb_open
+typedef struct KirbLazy KirbLazy;
+
+// Start a lazy parse, nothing is looked at until the first question. NULL if ctx is unusable or allocation failed
+// argv (and ctx) must outlive the handle
+KirbLazy *Kirb_open(int argc, char **argv, const KirbContext *ctx);
+// Whether the flag was given. Returns 1 if a value option missing its value cuts the parse short before it can tell
+int Kirb_get_flag(KirbLazy *lazy, int flag, int *present); // Output
+// Value of the value option, NULL if it wasn't given. Returns 1 like Kirb_get_flag
+int Kirb_get_value(KirbLazy *lazy, int value_opt, char **value); // Output
+// Next anonymous value in order, NULL once there are no more. Returns 1 like Kirb_get_flag
+int Kirb_next_anon(KirbLazy *lazy, char **anon); // Output
+// Resolve the rest and check the whole command line, the same result Kirb_parse_all_ctx would give
+int Kirb_finish(KirbLazy *lazy);
+void Kirb_close(KirbLazy *lazy);
+
+// Trace queue holding up to capacity messages (rounded up to a power of two), later ones are dropped until drained
+// NULL if allocation failed or capacity doesn't round up to a power of two that fits in a size_t
+KirbTrace *Kirb_trace_create(size_t capacity);
+void Kirb_trace_free(KirbTrace *trace);
+// Take the oldest message, 0 if there aren't any
+int Kirb_trace_pop(KirbTrace *trace, KirbEvent *event); // Output
+// Print and remove every queued message, returning how many were printed
+size_t Kirb_trace_drain(KirbTrace *trace, FILE *out);
+// Messages dropped because the queue was full
+size_t Kirb_trace_dropped(const KirbTrace *trace);
+
+// One command line for Kirb_parse_batch
+typedef struct KirbBatchItem
+{
+    int argc;
+    char **argv;
+} KirbBatchItem;
+
+// Items a batch worker takes from a queue at a time, so a batch needs more than this to use a second thread
+#define KIRB_BATCH_GRAIN 16
+// Fewest arguments worth giving a marking thread of its own
+#define KIRB_MARK_GRAIN 65536
+
+// Kirb_parse_all_ctx on every item, split over num_threads workers (0 for one per CPU)
+// Item i's outputs go to flags_out + i * num_flags, values_out + i * num_value_opts, num_anon[i], anon_out[i] and
+//  rets[i]. Returns -1 if the arguments are unusable, otherwise 0 and the per item return codes are in rets
+int Kirb_parse_batch(int num_items, const KirbBatchItem *items, const KirbContext *ctx, int num_threads,
+                     int *flags_out, char **values_out, int *num_anon, char ***anon_out, int *rets); // Outputs
+
+// Kirb_mark_ctx (or Kirb_mark_compact_ctx) over num_threads threads (0 for one per CPU), each with at least KIRB_MARK_GRAIN
+//  arguments to mark, so short command lines stay on the calling thread. Returns the number of anonymous values
+int Kirb_mark_parallel(int argc, char **argv, const KirbContext *ctx, enum Mark *marks, int num_threads); // Output
+int Kirb_mark_compact_parallel(int argc, char **argv, const KirbContext *ctx, uint8_t *marks, int num_threads);
+
+// All three phases in a single pass over argv, same outputs and return codes as Kirb_parse_table
+int Kirb_parse_fused(int argc, char **argv, const KirbTable *table, int allow_crossover,
+                     int *flags_out, char **values_out, int *num_anon, char ***anon_out); // Outputs
+
 // With short options only
 int Kirb_parse_short(int argc, char **argv,  // String to parse
                 int num_flags, char *flags, // Flag options
@@ -0,0 +1,415 @@
+// kirbparse.hpp
+// Header-only C++17 interface, with the option schema and its lookup tables built at compile time
+//
+// Declare the schema once as a constexpr object and everything Kirb_compile would do happens in the compiler:
+//
+//     constexpr kirb::Option options[] = { kirb::flag('v', "verbose"), kirb::flag("help"), kirb::value('o', "output") };
+//     constexpr kirb::Schema<3> schema(options);
+//     auto result = schema.parse(argc, argv);
+//     if(result.status == 0 && result.flag(schema.find("verbose"))) ...
+//
+// Parsing follows the same rules and gives the same status codes as Kirb_parse_all with kirbparse_debug off.
+// Short options resolve through a 256 entry array and long options through a perfect hash, so each argument costs a
+//  couple of table lookups and one name comparison.
+
+#ifndef KIRBPARSE_HPP
+#define KIRBPARSE_HPP
+
+#include <array>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+namespace kirb
+{
+    // One entry of a schema, see flag and value
+    struct Option
+    {
+        char short_name = '\0';
+        std::string_view long_name;
+        bool takes_value = false;
+    };
+
+    // A flag option, -v and --verbose
+    constexpr Option flag(char short_name, std::string_view long_name)
+    {
+        return { short_name, long_name, false };
+    }
+
+    // A flag option with its short form inferred from the long one, like Kirb_prep does
+    constexpr Option flag(std::string_view long_name)
+    {
+        return { long_name.empty() ? '\0' : long_name[0], long_name, false };
+    }
+
+    // A value option, -o file and --output file
+    constexpr Option value(char short_name, std::string_view long_name)
+    {
+        return { short_name, long_name, true };
+    }
+
+    constexpr Option value(std::string_view long_name)
+    {
+        return { long_name.empty() ? '\0' : long_name[0], long_name, true };
+    }
+
+    namespace detail
+    {
+        // FNV-1a over the whole name, seeded per bucket by mix to place it in the schema's perfect hash
+        constexpr std::uint32_t hash(std::string_view name)
+        {
+            std::uint32_t hash = 2166136261u;
+            for(char c : name)
+                hash = (hash ^ static_cast<unsigned char>(c)) * 16777619u;
+            return hash;
+        }
+
+        // Spread a name's hash with its bucket's seed to pick a slot
+        constexpr std::uint32_t mix(std::uint32_t hash, std::uint32_t seed)
+        {
+            hash ^= seed * 0x9e3779b9u;
+            hash ^= hash >> 16;
+            hash *= 0x85ebca6bu;
+            hash ^= hash >> 13;
+            hash *= 0xc2b2ae35u;
+            hash ^= hash >> 16;
+            return hash;
+        }
+
+        constexpr std::size_t ceil_pow2(std::size_t n)
+        {
+            std::size_t p = 1;
+            while(p < n)
+                p <<= 1;
+            return p;
+        }
+    }
+
+    // Parse results, indexed by the option's position in the schema
+    template <std::size_t N>
+    struct Result
+    {
+        int status = 0;                          // Same codes as Kirb_parse_all, the rest is only valid if 0
+        std::bitset<N> flags;                    // Set for every flag that was given
+        std::array<std::string_view, N> values;  // Value of every value option given, data() is nullptr if not
+        std::vector<std::string_view> anonymous;
+
+        bool flag(std::size_t option) const
+        {
+            return option < N && flags.test(option);
+        }
+
+        std::string_view value(std::size_t option) const
+        {
+            return option < N ? values[option] : std::string_view();
+        }
+    };
+
+    template <std::size_t N>
+    class Schema
+    {
+        // Options are indexed with int16_t throughout the tables, with -1 for none
+        static_assert(N <= static_cast<std::size_t>(std::numeric_limits<std::int16_t>::max()),
+                      "kirb::Schema: too many options for the int16_t indices");
+
+      public:
+        static constexpr std::size_t num_slots = detail::ceil_pow2(2 * N);
+        static constexpr std::size_t num_buckets = detail::ceil_pow2(N / 2 + 1);
+
+        constexpr explicit Schema(const Option (&options)[N], bool allow_crossover = false, bool werror = false)
+            : options_(), allow_crossover_(allow_crossover), werror_(werror), short_flag_(), short_value_(),
+              seeds_(), slot_name_(), slot_flag_(), slot_value_(), option_slot_()
+        {
+            for(std::size_t i = 0; i < 256; ++i)
+            {
+                short_flag_[i] = -1;
+                short_value_[i] = -1;
+            }
+            for(std::size_t s = 0; s < num_slots; ++s)
+            {
+                slot_name_[s] = -1;
+                slot_flag_[s] = -1;
+                slot_value_[s] = -1;
+            }
+            for(std::size_t i = 0; i < N; ++i)
+            {
+                options_[i] = options[i];
+                auto c = static_cast<unsigned char>(options[i].short_name);
+                auto &shorts = options[i].takes_value ? short_value_ : short_flag_;
+                if(c != '\0' && shorts[c] == -1)
+                    shorts[c] = static_cast<std::int16_t>(i);
+            }
+            build_hash();
+            // First option of each kind wins a shared name, just like the C table
+            for(std::size_t i = 0; i < N; ++i)
+            {
+                std::size_t s = option_slot_[i];
+                auto &slot = options_[i].takes_value ? slot_value_[s] : slot_flag_[s];
+                if(slot == -1)
+                    slot = static_cast<std::int16_t>(i);
+            }
+        }
+
+        // Position of the option with this long name, N if there isn't one
+        constexpr std::size_t find(std::string_view long_name) const
+        {
+            int s = lookup(long_name);
+            return s == -1 ? N : static_cast<std::size_t>(slot_name_[s]);
+        }
+
+        Result<N> parse(int argc, const char *const *argv) const
+        {
+            Result<N> result;
+            std::array<int, 256> short_count {};
+            std::array<int, num_slots> slot_count {};
+            int dashdash = 0;
+            bool takes_value = false, missing = false;
+            int pending = -1;
+
+            for(int i = 0; i < argc; ++i)
+            {
+                const char *arg = argv[i];
+                if(arg[0] == '-')
+                {
+                    if(!allow_crossover_)
+                        count(arg, short_count, slot_count, dashdash);
+                    if(missing)
+                        continue; // Only counting from here on, prep errors win over a missing value
+                    if(i > 0)
+                    {
+                        if(pending != -1)
+                        {
+                            missing = true;
+                            continue;
+                        }
+                        int f = lookup_flag(arg);
+                        if(f > -1)
+                            result.flags.set(static_cast<std::size_t>(f));
+                        else
+                            pending = lookup_value(arg);
+                    }
+                    takes_value = lookup_value(arg) != -1 ||
+                                  (arg[1] == '-' && arg[2] == '\0' && short_value_['-'] != -1);
+                }
+                else if(!missing)
+                {
+                    if(i > 0)
+                    {
+                        if(takes_value)
+                        {
+                            if(pending != -1)
+                                result.values[static_cast<std::size_t>(pending)] = arg;
+                            pending = -1;
+                        }
+                        else
+                            result.anonymous.emplace_back(arg);
+                    }
+                    takes_value = false;
+                }
+            }
+
+            if(!allow_crossover_ && crossover(short_count, slot_count, dashdash))
+                result.status = 1;
+            else if(missing || pending != -1)
+                result.status = 1;
+            if(result.status != 0)
+            {
+                result.flags.reset();
+                result.values = {};
+                result.anonymous.clear();
+            }
+            return result;
+        }
+
+        Result<N> parse(int argc, char **argv) const
+        {
+            return parse(argc, const_cast<const char *const *>(argv));
+        }
+
+      private:
+        std::array<Option, N> options_;
+        bool allow_crossover_;
+        bool werror_;
+        std::array<std::int16_t, 256> short_flag_;    // First flag for each short character, -1 if none
+        std::array<std::int16_t, 256> short_value_;   // First value option for each short character, -1 if none
+        std::array<std::uint16_t, num_buckets> seeds_;
+        std::array<std::int16_t, num_slots> slot_name_;  // First option with the slot's long name, -1 if empty
+        std::array<std::int16_t, num_slots> slot_flag_;
+        std::array<std::int16_t, num_slots> slot_value_;
+        std::array<std::uint16_t, N> option_slot_;      // Slot holding each option's long name
+
+        // Hash and displace: bucket the names, then find each bucket (biggest first) a seed that sends all of its
+        //  names to free slots
+        constexpr void build_hash()
+        {
+            std::array<int, N> unique {};  // Options that are the first with their long name
+            std::size_t num_unique = 0;
+            for(std::size_t i = 0; i < N; ++i)
+            {
+                bool seen = false;
+                for(std::size_t u = 0; u < num_unique && !seen; ++u)
+                    seen = options_[unique[u]].long_name == options_[i].long_name;
+                if(!seen)
+                    unique[num_unique++] = static_cast<int>(i);
+            }
+            for(std::size_t u = 0; u < num_unique; ++u)
+            {
+                for(std::size_t w = u + 1; w < num_unique; ++w)
+                {
+                    if(detail::hash(options_[unique[u]].long_name) == detail::hash(options_[unique[w]].long_name))
+                        throw std::logic_error("kirb::Schema: two long names share a hash, rename one of them");
+                }
+            }
+
+            std::array<std::size_t, num_buckets> bucket_size {};
+            for(std::size_t u = 0; u < num_unique; ++u)
+                ++bucket_size[detail::hash(options_[unique[u]].long_name) & (num_buckets - 1)];
+
+            std::array<bool, num_buckets> placed {};
+            for(std::size_t round = 0; round < num_buckets; ++round)
+            {
+                std::size_t b = num_buckets;
+                for(std::size_t c = 0; c < num_buckets; ++c)
+                {
+                    if(!placed[c] && (b == num_buckets || bucket_size[c] > bucket_size[b]))
+                        b = c;
+                }
+                placed[b] = true;
+                if(bucket_size[b] == 0)
+                    continue;
+
+                std::uint32_t seed = 1;
+                for(; seed < 65536; ++seed)
+                {
+                    if(try_seed(b, seed, unique, num_unique))
+                        break;
+                }
+                if(seed == 65536)
+                    throw std::logic_error("kirb::Schema: couldn't build a perfect hash for the long names");
+                seeds_[b] = static_cast<std::uint16_t>(seed);
+                for(std::size_t u = 0; u < num_unique; ++u)
+                {
+                    std::uint32_t h = detail::hash(options_[unique[u]].long_name);
+                    if((h & (num_buckets - 1)) == b)
+                        slot_name_[detail::mix(h, seed) & (num_slots - 1)] = static_cast<std::int16_t>(unique[u]);
+                }
+            }
+
+            for(std::size_t i = 0; i < N; ++i)
+                option_slot_[i] = static_cast<std::uint16_t>(lookup(options_[i].long_name));
+        }
+
+        // Whether seed puts every name in bucket b in a distinct free slot
+        constexpr bool try_seed(std::size_t b, std::uint32_t seed, const std::array<int, N> &unique,
+                                std::size_t num_unique) const
+        {
+            std::array<bool, num_slots> taken {};
+            for(std::size_t s = 0; s < num_slots; ++s)
+                taken[s] = slot_name_[s] != -1;
+            for(std::size_t u = 0; u < num_unique; ++u)
+            {
+                std::uint32_t h = detail::hash(options_[unique[u]].long_name);
+                if((h & (num_buckets - 1)) != b)
+                    continue;
+                std::size_t s = detail::mix(h, seed) & (num_slots - 1);
+                if(taken[s])
+                    return false;
+                taken[s] = true;
+            }
+            return true;
+        }
+
+        // Slot holding this long name, -1 if it isn't one
+        constexpr int lookup(std::string_view name) const
+        {
+            std::uint32_t h = detail::hash(name);
+            std::size_t s = detail::mix(h, seeds_[h & (num_buckets - 1)]) & (num_slots - 1);
+            int option = slot_name_[s];
+            return option != -1 && options_[static_cast<std::size_t>(option)].long_name == name
+                   ? static_cast<int>(s) : -1;
+        }
+
+        // Anything starting with -- is only ever a long option, like Kirb_parse_all
+        int lookup_flag(const char *arg) const
+        {
+            if(arg[1] == '\0')
+                return -1;
+            if(arg[1] == '-')
+            {
+                int s = lookup(arg + 2);
+                return s == -1 ? -1 : slot_flag_[s];
+            }
+            return arg[2] == '\0' ? short_flag_[static_cast<unsigned char>(arg[1])] : -1;
+        }
+
+        int lookup_value(const char *arg) const
+        {
+            if(arg[0] != '-' || arg[1] == '\0')
+                return -1;
+            if(arg[1] == '-')
+            {
+                int s = lookup(arg + 2);
+                return s == -1 ? -1 : slot_value_[s];
+            }
+            return arg[2] == '\0' ? short_value_[static_cast<unsigned char>(arg[1])] : -1;
+        }
+
+        // Tally a dashed argument the way the C library's crossover check sees it
+        void count(const char *arg, std::array<int, 256> &short_count, std::array<int, num_slots> &slot_count,
+                   int &dashdash) const
+        {
+            if(arg[1] == '\0')
+                ++short_count[0];
+            else if(arg[2] == '\0')
+            {
+                ++short_count[static_cast<unsigned char>(arg[1])];
+                if(arg[1] == '-')
+                    ++dashdash;
+            }
+            else
+            {
+                int s = lookup(arg + 2);
+                if(arg[1] == '-' && s != -1)
+                    ++slot_count[static_cast<std::size_t>(s)];
+            }
+        }
+
+        // Kirb_prep's verdict from the tallies: flags first, then value options, in schema order
+        bool crossover(const std::array<int, 256> &short_count, const std::array<int, num_slots> &slot_count,
+                       int dashdash) const
+        {
+            for(int pass = 0; pass < 2; ++pass)
+            {
+                for(std::size_t i = 0; i < N; ++i)
+                {
+                    const Option &option = options_[i];
+                    if(option.takes_value != (pass == 1))
+                        continue;
+                    int short_present = short_count[static_cast<unsigned char>(option.short_name)];
+                    int long_present = slot_count[option_slot_[i]];
+                    if(option.long_name.empty() && option.short_name != '-')
+                        long_present += dashdash;
+
+                    if(short_present && long_present)
+                        return true;
+                    if((short_present > 1 || long_present > 1) && (option.takes_value || werror_))
+                        return true;
+                }
+            }
+            return false;
+        }
+    };
+
+    template <std::size_t N>
+    Schema(const Option (&)[N]) -> Schema<N>;
+    template <std::size_t N>
+    Schema(const Option (&)[N], bool) -> Schema<N>;
+    template <std::size_t N>
+    Schema(const Option (&)[N], bool, bool) -> Schema<N>;
+}
+
+#endif //KIRBPARSE_HPP
@@ -0,0 +1,197 @@
+// kirbparse_internal.h
+// Pieces shared between the implementation files, not part of the library's interface
+
+#ifndef KIRBPARSE_INTERNAL_H
+#define KIRBPARSE_INTERNAL_H
+
+#include "kirbparse.h"
+#include <string.h>
+#include <time.h>
+
+// Arguments whose marks fit on the stack before a parse moves them to the heap
+#define KIRB_STACK_MARKS 4096
+// Long names in a table's pool start on, and are zero padded out to, a multiple of this, so kirbsimd.c can compare
+//  them a whole vector at a time
+#define KIRB_NAME_ALIGN 32
+
+// For loops that are built twice, with and without stats, so the version without them has no counting left in it
+#if defined(__GNUC__)
+    #define KIRB_INLINE static inline __attribute__((always_inline))
+#else
+    #define KIRB_INLINE static inline
+#endif
+
+// Everything a single pass over the arguments needs to remember
+struct tally
+{
+    int short_count[256];
+    int *slot_count;  // One per table slot
+    int dashdash;     // Bare "--" arguments
+};
+
+struct walk
+{
+    const KirbContext *ctx;
+    const KirbTable *table;
+    struct tally *tally;  // NULL when crossover is allowed
+    int *flags_out;
+    char **values_out;
+    int position;         // Index of the next argument
+    int takes_value;      // The previous argument marks this one as a value
+    int pending;          // Value option still waiting for its value, -1 if none
+};
+
+// Where a table's block came from, see KirbTable.source
+#define KIRB_SOURCE_COMPILED 0 // Allocated by Kirb_compile
+#define KIRB_SOURCE_BORROWED 1 // The caller's blob, see Kirb_load_table
+#define KIRB_SOURCE_MAPPED 2   // A file mapping, see Kirb_map_table
+
+// kirbblob.c
+void kirb_unmap_table(KirbTable *table);
+
+// kirbparse.c
+int kirb_check_sinks(void);
+
+// kirbsimd.c
+int kirb_lookup(const KirbTable *table, const char *name);
+
+// kirbtrie.c
+int kirb_trie_sort(const char **names, int *count);
+void kirb_trie_build(KirbTable *table, const char **names, int count);
+
+// kirbstats.c
+void kirb_event(const KirbContext *ctx, int code, int position, const char *arg);
+
+// kirbtable.c
+void kirb_table_layout(KirbTable *table);
+int kirb_check_context(const KirbContext *ctx);
+FILE *kirb_err(const KirbContext *ctx);
+void *kirb_alloc(const KirbContext *ctx, size_t size);
+void kirb_release(const KirbContext *ctx, void *ptr);
+int kirb_check_tally(const KirbContext *ctx, const struct tally *tally, int check_values);
+void kirb_tally_begin(struct tally *tally, int *slot_count, int num_slots);
+void kirb_walk_begin(struct walk *walk, const KirbContext *ctx, struct tally *tally,
+                     int *flags_out, char **values_out);
+int kirb_walk_arg(struct walk *walk, char *arg);
+int kirb_walk_end(struct walk *walk);
+
+// Clock for KirbStats, only read when stats were asked for
+static inline uint64_t kirb_now_ns(void)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+// Hash of a long name from its length and its first and last 16 bytes (zero padded, the same block twice if the
+//  name is shorter), so the vector kernels can hash straight from the blocks they load
+static inline unsigned int kirb_hash_words(size_t length, const uint64_t head[2], const uint64_t tail[2])
+{
+    // Four independent multiplies rather than a chain
+    uint64_t hash = ((head[0] ^ length) * 0x9E3779B97F4A7C15u) ^ (head[1] * 0xBF58476D1CE4E5B9u)
+                    ^ (tail[0] * 0xC2B2AE3D27D4EB4Fu) ^ (tail[1] * 0x165667B19E3779F9u);
+    // Multiplies only carry upwards, and names tend to differ at the end, so fold the top back down before mixing
+    hash ^= hash >> 32;
+    hash *= 0x94D049BB133111EBu;
+    return (unsigned int) (hash >> 32);
+}
+
+static inline unsigned int kirb_hash(const char *name)
+{
+    size_t length = strlen(name);
+    uint64_t head[2] = { 0, 0 }, tail[2];
+    memcpy(head, name, length < 16 ? length : 16);
+    if(length >= 16)
+        memcpy(tail, name + length - 16, sizeof(tail));
+    else
+        memcpy(tail, head, sizeof(tail));
+    return kirb_hash_words(length, head, tail);
+}
+
+// Slot holding name, or the empty slot where it would go
+static inline int kirb_probe(const KirbTable *table, const char *name, unsigned int hash)
+{
+    int mask = table->num_slots - 1;
+    int s = (int) (hash & mask);
+    while(table->slots[s].name != -1)
+    {
+        if(table->slots[s].hash == hash && strcmp(table->names + table->slots[s].name, name) == 0)
+            break;
+        s = (s + 1) & mask;
+    }
+    return s;
+}
+
+// Slot matching a --long argument, -1 if it's not one of ours
+static inline int kirb_find_long(const KirbTable *table, const char *arg)
+{
+    if(arg[0] != '-' || arg[1] != '-')
+        return -1;
+    return kirb_lookup(table, arg + 2);
+}
+
+// Table equivalents of matching an option in the parse phase, -1 if arg isn't a flag (or value option)
+// Like Kirb_parse_all, anything starting with -- is only ever a long option
+static inline int kirb_flag(const KirbTable *table, const char *arg)
+{
+    if(arg[0] != '-' || arg[1] == '\0')
+        return -1;
+    if(arg[1] == '-')
+    {
+        int s = kirb_find_long(table, arg);
+        return s == -1 ? -1 : table->slots[s].flag;
+    }
+    return arg[2] == '\0' ? table->short_flag[(unsigned char) arg[1]] : -1;
+}
+
+static inline int kirb_value(const KirbTable *table, const char *arg)
+{
+    if(arg[0] != '-' || arg[1] == '\0')
+        return -1;
+    if(arg[1] == '-')
+    {
+        int s = kirb_find_long(table, arg);
+        return s == -1 ? -1 : table->slots[s].value;
+    }
+    return arg[2] == '\0' ? table->short_value[(unsigned char) arg[1]] : -1;
+}
+
+// Whether the mark phase treats the argument after arg as a value
+// Kirb_mark tries both matchers, so a bare "--" also counts when '-' is a short value option
+static inline int kirb_takes_value(const KirbTable *table, const char *arg)
+{
+    if(kirb_value(table, arg) != -1)
+        return 1;
+    return arg[0] == '-' && arg[1] == '-' && arg[2] == '\0' && table->short_value['-'] != -1;
+}
+
+// Mark for argv[i], i > 0
+static inline enum Mark kirb_mark_one(const KirbTable *table, char **argv, int i)
+{
+    if(argv[i][0] == '-')
+        return argv[i][1] == '-' ? OPTION_LONG : OPTION_SHORT;
+    return kirb_takes_value(table, argv[i - 1]) ? VALUE : ANONYMOUS;
+}
+
+// Tally one dashed argument for the crossover check
+// crossover_check compares each rule against the whole argument, so "-" is the short form of '\0' and "--" is
+//  the short form of '-' before it is ever the long form of ""
+static inline void kirb_count_arg(const KirbTable *table, const char *arg, struct tally *tally)
+{
+    if(arg[1] == '\0')
+        ++tally->short_count[0];
+    else if(arg[2] == '\0')
+    {
+        ++tally->short_count[(unsigned char) arg[1]];
+        if(arg[1] == '-')
+            ++tally->dashdash;
+    }
+    else
+    {
+        int s = kirb_find_long(table, arg);
+        if(s != -1)
+            ++tally->slot_count[s];
+    }
+}
+
+#endif //KIRBPARSE_INTERNAL_H
@@ -0,0 +1,423 @@
+// kirbresponse.c
+// Expanding @file arguments, with the file mapped and split into arguments where it lies
+
+#include "kirbparse.h"
+#include "kirbparse_internal.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(_WIN32)
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+    #if !defined(MAP_ANONYMOUS)
+        #define MAP_ANONYMOUS MAP_ANON
+    #endif
+#endif
+
+// File-scope types
+// One response file, tokenized in place: num_tokens NUL terminated arguments back to back from data
+struct response
+{
+    char *data;
+    size_t size;    // Bytes mapped (or allocated) at data
+    int mapped;     // 0 if data came from the heap
+    int num_tokens;
+#if !defined(_WIN32)
+    dev_t dev;      // Which file it was, to catch a file naming itself however the path is spelt
+    ino_t ino;
+#else
+    const char *path;
+#endif
+};
+
+// The responses in the order expand meets them, first while counting and then again while filling in
+struct responses
+{
+    const KirbContext *ctx;
+    struct response *list;
+    int count;
+    int capacity;
+    int next;       // Next response to use while filling in
+    int loaded;     // Files actually read, up to KIRB_RESPONSE_FILES
+    int active[KIRB_RESPONSE_DEPTH]; // While counting, the response being expanded at each depth
+};
+
+// Header of KirbArgs.block, followed by the responses, the argument pointers and their lengths
+struct args_block
+{
+    size_t num_responses; // A size_t, so the responses after it stay aligned
+};
+
+// File-scope helper functions
+static void *args_alloc(const KirbContext *ctx, size_t size);
+static void args_release(const KirbContext *ctx, void *ptr);
+static int expand(struct responses *responses, char *arg, int depth, KirbArgs *args, int *count);
+static int add_count(int *count);
+static int is_active(const struct responses *responses, const struct response *response, int depth);
+static int load(const char *path, struct response *response);
+static void unload(struct response *response);
+static int tokenize(char *data, size_t size);
+static int is_space(char c);
+
+int Kirb_expand(int argc, char **argv, const KirbContext *ctx, KirbArgs *args)
+{
+    if(args == NULL || argc < 0 || (argc > 0 && argv == NULL))
+        return -1;
+    args->argc = 0;
+    args->argv = NULL;
+    args->lengths = NULL;
+    args->block = NULL;
+
+    // Count, loading every response file on the way, then fill in from the files already loaded
+    struct responses responses = { ctx, NULL, 0, 0, 0, 0, { 0 } };
+    int count = 0;
+    for(int i = 0; i < argc; ++i)
+    {
+        if(i == 0)
+            ++count; // The program name is never a response file
+        else if(expand(&responses, argv[i], 0, NULL, &count) == -1)
+        {
+            for(int r = 0; r < responses.count; ++r)
+                unload(&responses.list[r]);
+            args_release(ctx, responses.list);
+            return -1;
+        }
+    }
+
+    size_t head = sizeof(struct args_block) + responses.count * sizeof(struct response);
+    head = (head + sizeof(char*) - 1) / sizeof(char*) * sizeof(char*);
+    char *block = args_alloc(ctx, head + count * (sizeof(char*) + sizeof(size_t)));
+    if(block == NULL)
+    {
+        for(int r = 0; r < responses.count; ++r)
+            unload(&responses.list[r]);
+        args_release(ctx, responses.list);
+        return -1;
+    }
+    ((struct args_block*) block)->num_responses = responses.count;
+    if(responses.count > 0)
+        memcpy(block + sizeof(struct args_block), responses.list, responses.count * sizeof(struct response));
+    args->block = block;
+    args->argv = (char**) (block + head);
+    args->lengths = (size_t*) (args->argv + count);
+
+    for(int i = 0; i < argc; ++i)
+    {
+        if(i == 0)
+        {
+            args->lengths[args->argc] = strlen(argv[0]);
+            args->argv[args->argc++] = argv[0];
+        }
+        else
+            expand(&responses, argv[i], 0, args, NULL);
+    }
+    args_release(ctx, responses.list);
+    return 0;
+}
+
+void Kirb_free_args(const KirbContext *ctx, KirbArgs *args)
+{
+    if(args == NULL || args->block == NULL)
+        return;
+    struct args_block *block = args->block;
+    struct response *list = (struct response*) (block + 1);
+    for(size_t r = 0; r < block->num_responses; ++r)
+        unload(&list[r]);
+    args_release(ctx, args->block);
+    args->block = NULL;
+    args->argv = NULL;
+    args->lengths = NULL;
+    args->argc = 0;
+}
+
+static void *args_alloc(const KirbContext *ctx, size_t size)
+{
+    return ctx != NULL ? kirb_alloc(ctx, size) : malloc(size);
+}
+
+static void args_release(const KirbContext *ctx, void *ptr)
+{
+    if(ctx != NULL)
+        kirb_release(ctx, ptr);
+    else
+        free(ptr);
+}
+
+// Expand one argument: while counting (args NULL) add up how many it becomes, otherwise append them to args
+static int expand(struct responses *responses, char *arg, int depth, KirbArgs *args, int *count)
+{
+    if(arg[0] != '@' || arg[1] == '\0' || depth >= KIRB_RESPONSE_DEPTH)
+    {
+        if(args == NULL)
+            return add_count(count);
+        else
+        {
+            args->lengths[args->argc] = strlen(arg);
+            args->argv[args->argc++] = arg;
+        }
+        return 0;
+    }
+
+    // Every @ argument gets a response in the list, even if it turns out not to be a file, so both passes line up
+    struct response *response;
+    if(args == NULL)
+    {
+        if(responses->count == responses->capacity)
+        {
+            int capacity = responses->capacity > 0 ? responses->capacity * 2 : 4;
+            struct response *list = args_alloc(responses->ctx, capacity * sizeof(struct response));
+            if(list == NULL)
+                return -1;
+            if(responses->count > 0)
+                memcpy(list, responses->list, responses->count * sizeof(struct response));
+            args_release(responses->ctx, responses->list);
+            responses->list = list;
+            responses->capacity = capacity;
+        }
+        response = &responses->list[responses->count];
+        if(load(arg + 1, response) == -1)
+            return -1;
+        ++responses->count;
+        // A file inside itself is left as an argument, the way one past the depth limit is
+        if(response->num_tokens != -1 && is_active(responses, response, depth))
+        {
+            unload(response);
+            response->data = NULL;
+            response->num_tokens = -1;
+        }
+        if(response->num_tokens != -1 && ++responses->loaded > KIRB_RESPONSE_FILES)
+            return -1;
+        responses->active[depth] = responses->count - 1;
+    }
+    else
+        response = &responses->list[responses->next++];
+
+    // Like gcc, an @ argument that can't be read is left as it is
+    if(response->num_tokens == -1)
+    {
+        if(args == NULL)
+            return add_count(count);
+        else
+        {
+            args->lengths[args->argc] = strlen(arg);
+            args->argv[args->argc++] = arg;
+        }
+        return 0;
+    }
+
+    // The list may move while nested files are counted, so hold on to the data rather than the response
+    char *token = response->data;
+    int num_tokens = response->num_tokens;
+    for(int t = 0; t < num_tokens; ++t)
+    {
+        size_t length = strlen(token);
+        if(token[0] == '@')
+        {
+            if(expand(responses, token, depth + 1, args, count) == -1)
+                return -1;
+        }
+        else if(args == NULL)
+        {
+            if(add_count(count) == -1)
+                return -1;
+        }
+        else
+        {
+            args->lengths[args->argc] = length;
+            args->argv[args->argc++] = token;
+        }
+        token += length + 1;
+    }
+    return 0;
+}
+
+// One more argument while counting, -1 once there would be more than an int can count
+static int add_count(int *count)
+{
+    if(*count == INT_MAX)
+        return -1;
+    ++*count;
+    return 0;
+}
+
+// Whether response is the same file as one of the depth responses it's nested in
+static int is_active(const struct responses *responses, const struct response *response, int depth)
+{
+    for(int d = 0; d < depth; ++d)
+    {
+        const struct response *outer = &responses->list[responses->active[d]];
+#if !defined(_WIN32)
+        if(outer->dev == response->dev && outer->ino == response->ino)
+            return 1;
+#else
+        if(strcmp(outer->path, response->path) == 0)
+            return 1;
+#endif
+    }
+    return 0;
+}
+
+// Map (or read) a response file and split it into arguments
+// Returns -1 if it exists but couldn't be loaded, otherwise 0 with num_tokens -1 if there was no file to load
+static int load(const char *path, struct response *response)
+{
+    response->data = NULL;
+    response->size = 0;
+    response->mapped = 0;
+    response->num_tokens = -1;
+#if defined(_WIN32)
+    response->path = path;
+#endif
+
+#if !defined(_WIN32)
+    int fd = open(path, O_RDONLY);
+    if(fd == -1)
+        return 0;
+    struct stat st;
+    if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        close(fd);
+        return 0;
+    }
+
+    response->dev = st.st_dev;
+    response->ino = st.st_ino;
+    size_t size = (size_t) st.st_size;
+    if(size == 0)
+    {
+        close(fd);
+        response->num_tokens = 0;
+        return 0;
+    }
+    // Tokenizing needs one byte past the end for the last NUL. The tail of the file's last page is zeroes, but if
+    //  the file fills that page exactly the byte has to come from an anonymous page reserved right after it
+    long page = sysconf(_SC_PAGESIZE);
+    size_t map_size = (size + 1 + page - 1) / page * page;
+    char *data = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(data == MAP_FAILED)
+    {
+        close(fd);
+        return -1;
+    }
+    // Private, so tokenizing in place never reaches the file
+    if(mmap(data, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)
+    {
+        munmap(data, map_size);
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    response->mapped = 1;
+#else
+    FILE *file = fopen(path, "rb");
+    if(file == NULL)
+        return 0;
+    if(fseek(file, 0, SEEK_END) != 0)
+    {
+        fclose(file);
+        return 0;
+    }
+    long end = ftell(file);
+    if(end < 0 || fseek(file, 0, SEEK_SET) != 0)
+    {
+        fclose(file);
+        return 0;
+    }
+    size_t size = (size_t) end, map_size = size + 1;
+    char *data = malloc(map_size);
+    if(data == NULL || fread(data, 1, size, file) != size)
+    {
+        free(data);
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+#endif
+
+    response->data = data;
+    response->size = map_size;
+    response->num_tokens = tokenize(data, size);
+    return 0;
+}
+
+static void unload(struct response *response)
+{
+    if(response->data == NULL)
+        return;
+#if !defined(_WIN32)
+    if(response->mapped)
+    {
+        munmap(response->data, response->size);
+        return;
+    }
+#endif
+    free(response->data);
+}
+
+// Split size bytes of data into NUL terminated arguments packed from the start of data, returning how many
+// Whitespace separates arguments, single quotes keep everything up to the next one, double quotes keep everything
+//  but a backslash (which escapes the next character, same as outside quotes). Stray NUL bytes separate arguments
+//  too, or are dropped inside quotes, so the arguments can be found again by their terminators
+// Output never gets ahead of input, except for the final NUL, which may land at data[size]
+static int tokenize(char *data, size_t size)
+{
+    char *in = data, *end = data + size, *out = data;
+    int count = 0;
+
+    for(;;)
+    {
+        while(in < end && is_space(*in))
+            ++in;
+        if(in == end)
+            break;
+
+        while(in < end && !is_space(*in))
+        {
+            if(*in == '\'')
+            {
+                for(++in; in < end && *in != '\''; ++in)
+                {
+                    if(*in != '\0')
+                        *out++ = *in;
+                }
+                if(in < end)
+                    ++in;
+            }
+            else if(*in == '"')
+            {
+                for(++in; in < end && *in != '"'; )
+                {
+                    if(*in == '\\' && in + 1 < end)
+                        ++in;
+                    if(*in != '\0')
+                        *out++ = *in;
+                    ++in;
+                }
+                if(in < end)
+                    ++in;
+            }
+            else
+            {
+                if(*in == '\\' && in + 1 < end)
+                    ++in;
+                if(*in != '\0')
+                    *out++ = *in;
+                ++in;
+            }
+        }
+        if(in < end)
+            ++in; // Past the separator before it could be overwritten
+        *out++ = '\0';
+        ++count;
+    }
+    return count;
+}
+
+static int is_space(char c)
+{
+    return c == '\0' || c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+}
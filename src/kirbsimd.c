@@ -0,0 +1,237 @@
+// kirbsimd.c
+// Looking up long names with vector loads, using the widest kernel the CPU supports
+
+#include "kirbparse.h"
+#include "kirbparse_internal.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #define KIRB_X86 1
+    #include <immintrin.h>
+#else
+    #define KIRB_X86 0
+#endif
+
+// The kernels read whole blocks around an argument, which is safe within a page but not to a sanitizer
+#if defined(__clang__) || defined(__GNUC__)
+    #define KIRB_WIDE_LOADS __attribute__((no_sanitize_address))
+#else
+    #define KIRB_WIDE_LOADS
+#endif
+
+// Loads past an argument's NUL have to stay on the page the NUL is on
+#define KIRB_PAGE 4096
+
+// File-scope helper functions
+static int lookup_scalar(const KirbTable *table, const char *name);
+#if KIRB_X86
+static int lookup_sse2(const KirbTable *table, const char *name);
+static int lookup_avx2(const KirbTable *table, const char *name);
+static __m128i load_sse2(const char *at, size_t left);
+static __m256i load_avx2(const char *at, size_t left);
+#endif
+
+static int (*lookup)(const KirbTable *table, const char *name) = lookup_scalar;
+static const char *kernel = "scalar";
+
+#if KIRB_X86
+// Picked once before main, so parsing threads only ever read the choice
+// Scalar unless KIRBPARSE_SIMD names a kernel: neither vector kernel beats it yet on KirbBench's long names
+__attribute__((constructor)) static void pick_kernel(void)
+{
+    const char *name = getenv("KIRBPARSE_SIMD");
+    if(name != NULL)
+        Kirb_simd_use(name);
+}
+#endif
+
+const char *Kirb_simd_kernel(void)
+{
+    return kernel;
+}
+
+int Kirb_simd_use(const char *name)
+{
+    if(name == NULL)
+        return -1;
+    if(strcmp(name, "scalar") == 0)
+    {
+        lookup = lookup_scalar;
+        kernel = "scalar";
+        return 0;
+    }
+#if KIRB_X86
+    __builtin_cpu_init();
+    if(strcmp(name, "sse2") == 0 && __builtin_cpu_supports("sse2"))
+    {
+        lookup = lookup_sse2;
+        kernel = "sse2";
+        return 0;
+    }
+    if(strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2"))
+    {
+        lookup = lookup_avx2;
+        kernel = "avx2";
+        return 0;
+    }
+#endif
+    return -1;
+}
+
+int kirb_lookup(const KirbTable *table, const char *name)
+{
+    return lookup(table, name);
+}
+
+static int lookup_scalar(const KirbTable *table, const char *name)
+{
+    int s = kirb_probe(table, name, kirb_hash(name));
+    return table->slots[s].name == -1 ? -1 : s;
+}
+
+#if KIRB_X86
+// The next left bytes from at (left > 0) with the rest of the block zeroed, the way the pool pads its names
+__attribute__((target("sse2"))) KIRB_WIDE_LOADS
+static __m128i load_sse2(const char *at, size_t left)
+{
+    if(left >= 16)
+        return _mm_loadu_si128((const __m128i*) at);
+    __m128i block;
+    if(((uintptr_t) at & (KIRB_PAGE - 1)) <= KIRB_PAGE - 16)
+        block = _mm_loadu_si128((const __m128i*) at);
+    else
+    {
+        char copy[16] = { 0 };
+        memcpy(copy, at, left);
+        block = _mm_loadu_si128((const __m128i*) copy);
+    }
+    const __m128i index = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    return _mm_and_si128(block, _mm_cmpgt_epi8(_mm_set1_epi8((char) left), index));
+}
+
+__attribute__((target("sse2"))) KIRB_WIDE_LOADS
+static int lookup_sse2(const KirbTable *table, const char *name)
+{
+    // Length, from aligned loads, which can't cross a page
+    const __m128i zero = _mm_setzero_si128();
+    const char *at = (const char*) ((uintptr_t) name & ~(uintptr_t) 15);
+    unsigned int nul = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128((const __m128i*) at), zero));
+    nul >>= name - at;
+    size_t length;
+    if(nul != 0)
+        length = (size_t) __builtin_ctz(nul);
+    else
+    {
+        do
+        {
+            at += 16;
+            nul = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128((const __m128i*) at), zero));
+        } while(nul == 0);
+        length = (size_t) (at - name) + (size_t) __builtin_ctz(nul);
+    }
+
+    uint64_t head[2], tail[2];
+    __m128i first = load_sse2(name, length + 1);
+    _mm_storeu_si128((__m128i*) head, first);
+    if(length >= 16)
+        _mm_storeu_si128((__m128i*) tail, _mm_loadu_si128((const __m128i*) (name + length - 16)));
+    else
+        memcpy(tail, head, sizeof(tail));
+    unsigned int hash = kirb_hash_words(length, head, tail);
+
+    int mask = table->num_slots - 1;
+    for(int s = (int) (hash & mask); table->slots[s].name != -1; s = (s + 1) & mask)
+    {
+        if(table->slots[s].hash != hash)
+            continue;
+        // A block at a time up to and including the NUL, the first mismatch rejects
+        const char *pool = table->names + table->slots[s].name;
+        __m128i block = first;
+        for(size_t offset = 0; ; )
+        {
+            __m128i same = _mm_cmpeq_epi8(block, _mm_loadu_si128((const __m128i*) (pool + offset)));
+            if(_mm_movemask_epi8(same) != 0xFFFF)
+                break;
+            offset += 16;
+            if(offset > length)
+                return s;
+            block = load_sse2(name + offset, length + 1 - offset);
+        }
+    }
+    return -1;
+}
+
+__attribute__((target("avx2"))) KIRB_WIDE_LOADS
+static __m256i load_avx2(const char *at, size_t left)
+{
+    if(left >= 32)
+        return _mm256_loadu_si256((const __m256i*) at);
+    __m256i block;
+    if(((uintptr_t) at & (KIRB_PAGE - 1)) <= KIRB_PAGE - 32)
+        block = _mm256_loadu_si256((const __m256i*) at);
+    else
+    {
+        char copy[32] = { 0 };
+        memcpy(copy, at, left);
+        block = _mm256_loadu_si256((const __m256i*) copy);
+    }
+    const __m256i index = _mm256_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+                                           16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31);
+    return _mm256_and_si256(block, _mm256_cmpgt_epi8(_mm256_set1_epi8((char) left), index));
+}
+
+// Same as lookup_sse2, 32 bytes at a time
+__attribute__((target("avx2"))) KIRB_WIDE_LOADS
+static int lookup_avx2(const KirbTable *table, const char *name)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const char *at = (const char*) ((uintptr_t) name & ~(uintptr_t) 31);
+    unsigned int nul = (unsigned int) _mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(_mm256_load_si256((const __m256i*) at), zero));
+    nul >>= name - at;
+    size_t length;
+    if(nul != 0)
+        length = (size_t) __builtin_ctz(nul);
+    else
+    {
+        do
+        {
+            at += 32;
+            nul = (unsigned int) _mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(_mm256_load_si256((const __m256i*) at), zero));
+        } while(nul == 0);
+        length = (size_t) (at - name) + (size_t) __builtin_ctz(nul);
+    }
+
+    // The hash only looks at the first and last 16 bytes, whatever the kernel
+    uint64_t head[2], tail[2];
+    __m256i first = load_avx2(name, length + 1);
+    _mm_storeu_si128((__m128i*) head, _mm256_castsi256_si128(first));
+    if(length >= 16)
+        _mm_storeu_si128((__m128i*) tail, _mm_loadu_si128((const __m128i*) (name + length - 16)));
+    else
+        memcpy(tail, head, sizeof(tail));
+    unsigned int hash = kirb_hash_words(length, head, tail);
+
+    int mask = table->num_slots - 1;
+    for(int s = (int) (hash & mask); table->slots[s].name != -1; s = (s + 1) & mask)
+    {
+        if(table->slots[s].hash != hash)
+            continue;
+        const char *pool = table->names + table->slots[s].name;
+        __m256i block = first;
+        for(size_t offset = 0; ; )
+        {
+            __m256i same = _mm256_cmpeq_epi8(block, _mm256_loadu_si256((const __m256i*) (pool + offset)));
+            if((unsigned int) _mm256_movemask_epi8(same) != 0xFFFFFFFFu)
+                break;
+            offset += 32;
+            if(offset > length)
+                return s;
+            block = load_avx2(name + offset, length + 1 - offset);
+        }
+    }
+    return -1;
+}
+#endif
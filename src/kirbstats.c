@@ -0,0 +1,183 @@
+// kirbstats.c
+// Debug messages, printed right away or queued on a trace for later
+
+#include "kirbparse.h"
+#include "kirbparse_internal.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#if !defined(_WIN32)
+    #include <stdatomic.h>
+#endif
+
+// Single producer, single consumer ring. head and tail only ever grow, their difference is how much is queued
+struct KirbTrace
+{
+    KirbEvent *events;
+    size_t mask; // Capacity - 1
+#if !defined(_WIN32)
+    atomic_size_t head; // Next slot the parse writes
+    atomic_size_t tail; // Next slot the reader takes
+    atomic_size_t dropped;
+#else
+    volatile size_t head; // No atomics on Windows yet, so there a trace is only safe on one thread
+    volatile size_t tail;
+    size_t dropped;
+#endif
+};
+
+// Text of each message and whether it goes to err rather than info when printed right away, indexed by code
+static const struct
+{
+    const char *text;
+    int to_err;
+} messages[] = {
+    [EVENT_BEGIN_CROSSOVER] = { "INFO: KIRBPARSE: Begin crossover", 0 },
+    [EVENT_END_CROSSOVER] = { "INFO: KIRBPARSE: End crossover", 0 },
+    [EVENT_CROSSOVER] = { "ERROR: KIRBPARSE: crossover found", 1 },
+    [EVENT_DUPLICATE_FLAG] = { "INFO: KIRBPARSE: duplicate flag found", 0 },
+    [EVENT_DUPLICATE_FLAG_ERROR] = { "ERROR: KIRBPARSE: duplicate flag found", 0 },
+    [EVENT_DUPLICATE_VALUE] = { "ERROR: KIRBPARSE: duplicate value option found", 1 },
+    [EVENT_FOUND_FLAG] = { "INFO: KIRBPARSE: Found flag at", 0 },
+    [EVENT_FOUND_VALUE] = { "INFO: KIRBPARSE: Found value option at", 0 },
+    [EVENT_MISSING_VALUE] = { "ERROR: KIRBPARSE: Parse Error: value option missing value", 1 },
+    [EVENT_PREP_ERROR] = { "ERROR: KIRBPARSE: Prep Error: Duplicate or crossover found", 1 },
+    [EVENT_NO_MARKS] = { "KIRBPARSE: ERROR: Mark phase array is uninitialized", 1 },
+    [EVENT_ANON_NOT_NULL] = { "KIRBPARSE: ERROR: Parse Error: Non-NULL pointer at *anon_out", 1 },
+    [EVENT_AMBIGUOUS_OPTION] = { "ERROR: KIRBPARSE: Parse Error: abbreviation matches more than one option", 1 },
+    [EVENT_FLAG_WITH_VALUE] = { "ERROR: KIRBPARSE: Parse Error: flag given a value", 1 },
+    [EVENT_TOO_MANY_VALUES] = { "ERROR: KIRBPARSE: Parse Error: value option given too many values", 1 },
+    [EVENT_BAD_VALUE] = { "ERROR: KIRBPARSE: Parse Error: value doesn't fit its option's type", 1 },
+    [EVENT_UNKNOWN_COMMAND] = { "ERROR: KIRBPARSE: Parse Error: unknown subcommand", 1 },
+    [EVENT_BAD_SETTING] = { "ERROR: KIRBPARSE: Parse Error: bad setting in the config file or environment", 1 },
+};
+
+// File-scope helper functions
+static void print_event(FILE *out, const KirbEvent *event);
+static void push(KirbTrace *trace, const KirbEvent *event);
+
+KirbTrace *Kirb_trace_create(size_t capacity)
+{
+    // Above the largest power of two, rounding up would wrap size round to 0 and never end
+    if(capacity > SIZE_MAX / 2 + 1)
+        return NULL;
+    size_t size = 1;
+    while(size < capacity)
+        size <<= 1;
+    if(size > SIZE_MAX / sizeof(KirbEvent))
+        return NULL;
+
+    KirbTrace *trace = malloc(sizeof(KirbTrace));
+    if(trace == NULL)
+        return NULL;
+    trace->events = malloc(size * sizeof(KirbEvent));
+    if(trace->events == NULL)
+    {
+        free(trace);
+        return NULL;
+    }
+    trace->mask = size - 1;
+#if !defined(_WIN32)
+    atomic_init(&trace->head, 0);
+    atomic_init(&trace->tail, 0);
+    atomic_init(&trace->dropped, 0);
+#else
+    trace->head = 0;
+    trace->tail = 0;
+    trace->dropped = 0;
+#endif
+    return trace;
+}
+
+void Kirb_trace_free(KirbTrace *trace)
+{
+    if(trace == NULL)
+        return;
+    free(trace->events);
+    free(trace);
+}
+
+int Kirb_trace_pop(KirbTrace *trace, KirbEvent *event)
+{
+    if(trace == NULL || event == NULL)
+        return 0;
+#if !defined(_WIN32)
+    size_t tail = atomic_load_explicit(&trace->tail, memory_order_relaxed);
+    if(tail == atomic_load_explicit(&trace->head, memory_order_acquire))
+        return 0;
+    *event = trace->events[tail & trace->mask];
+    atomic_store_explicit(&trace->tail, tail + 1, memory_order_release);
+#else
+    if(trace->tail == trace->head)
+        return 0;
+    *event = trace->events[trace->tail & trace->mask];
+    ++trace->tail;
+#endif
+    return 1;
+}
+
+size_t Kirb_trace_drain(KirbTrace *trace, FILE *out)
+{
+    KirbEvent event;
+    size_t count = 0;
+    while(Kirb_trace_pop(trace, &event))
+    {
+        if(out != NULL)
+            print_event(out, &event);
+        ++count;
+    }
+    return count;
+}
+
+size_t Kirb_trace_dropped(const KirbTrace *trace)
+{
+    if(trace == NULL)
+        return 0;
+#if !defined(_WIN32)
+    return atomic_load_explicit(&((KirbTrace*) trace)->dropped, memory_order_relaxed);
+#else
+    return trace->dropped;
+#endif
+}
+
+// Queue a message if the context has a trace, print it otherwise
+void kirb_event(const KirbContext *ctx, int code, int position, const char *arg)
+{
+    KirbEvent event = { code, position, arg };
+    if(ctx->trace != NULL)
+        push(ctx->trace, &event);
+    else
+        print_event(messages[code].to_err ? kirb_err(ctx) : ctx->info, &event);
+}
+
+static void print_event(FILE *out, const KirbEvent *event)
+{
+    if(event->arg != NULL)
+        fprintf(out, "%s %s\n", messages[event->code].text, event->arg);
+    else
+        fprintf(out, "%s\n", messages[event->code].text);
+}
+
+// Never blocks the parse, a full queue drops the message and counts it
+static void push(KirbTrace *trace, const KirbEvent *event)
+{
+#if !defined(_WIN32)
+    size_t head = atomic_load_explicit(&trace->head, memory_order_relaxed);
+    if(head - atomic_load_explicit(&trace->tail, memory_order_acquire) > trace->mask)
+    {
+        atomic_fetch_add_explicit(&trace->dropped, 1, memory_order_relaxed);
+        return;
+    }
+    trace->events[head & trace->mask] = *event;
+    atomic_store_explicit(&trace->head, head + 1, memory_order_release);
+#else
+    if(trace->head - trace->tail > trace->mask)
+    {
+        ++trace->dropped;
+        return;
+    }
+    trace->events[trace->head & trace->mask] = *event;
+    ++trace->head;
+#endif
+}
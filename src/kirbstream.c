@@ -0,0 +1,89 @@
+// kirbstream.c
+// Parsing arguments as they arrive, handing anonymous values over one at a time
+
+#include "kirbparse.h"
+#include "kirbparse_internal.h"
+#include <stdint.h>
+
+// The tally's slot counts share the stream's allocation, right after it
+struct KirbStream
+{
+    const KirbContext *ctx;
+    struct walk walk;
+    struct tally tally;
+    KirbAnonFn on_anon;
+    void *user;
+    int stopped; // A value option turned up without its value, later arguments are only tallied
+};
+
+KirbStream *Kirb_stream_open(const KirbContext *ctx, int *flags_out, char **values_out,
+                             KirbAnonFn on_anon, void *user)
+{
+    if(ctx == NULL || ctx->table.block == NULL || on_anon == NULL ||
+       (ctx->table.num_flags > 0 && flags_out == NULL) || (ctx->table.num_value_opts > 0 && values_out == NULL))
+        return NULL;
+
+    const KirbTable *table = &ctx->table;
+    KirbStream *stream = kirb_alloc(ctx, sizeof(KirbStream) + table->num_slots * sizeof(int));
+    if(stream == NULL)
+        return NULL;
+
+    for(int i = 0; i < table->num_flags; ++i)
+        flags_out[i] = 0;
+    for(int i = 0; i < table->num_value_opts; ++i)
+        values_out[i] = NULL;
+    stream->ctx = ctx;
+    kirb_tally_begin(&stream->tally, (int*) (stream + 1), table->num_slots);
+    kirb_walk_begin(&stream->walk, ctx, &stream->tally, flags_out, values_out);
+    stream->on_anon = on_anon;
+    stream->user = user;
+    stream->stopped = 0;
+    return stream;
+}
+
+int Kirb_stream_push(KirbStream *stream, int argc, char **argv)
+{
+    if(stream == NULL || argc < 0 || (argc > 0 && argv == NULL))
+        return -1;
+
+    int i = 0;
+    for(; i < argc && !stream->stopped; ++i)
+    {
+        int position = stream->walk.position;
+        int mark = kirb_walk_arg(&stream->walk, argv[i]);
+        if(mark == ANONYMOUS)
+            stream->on_anon(argv[i], position, stream->user);
+        else if(mark == -1)
+            stream->stopped = 1; // Kirb_parse_all stops extracting at the same argument, already tallied
+    }
+    // Prep errors still win over a missing value, so whatever is left only needs counting
+    for(; i < argc; ++i)
+    {
+        if(stream->walk.tally != NULL && argv[i][0] == '-')
+            kirb_count_arg(&stream->ctx->table, argv[i], &stream->tally);
+    }
+    return stream->stopped ? 1 : 0;
+}
+
+int Kirb_stream_end(KirbStream *stream)
+{
+    if(stream == NULL)
+        return -1;
+    int ret = kirb_walk_end(&stream->walk);
+    if(ret == 1)
+    {
+        // Prep would have stopped Kirb_parse_all before anything was written
+        for(int i = 0; i < stream->ctx->table.num_flags; ++i)
+            stream->walk.flags_out[i] = 0;
+        for(int i = 0; i < stream->ctx->table.num_value_opts; ++i)
+            stream->walk.values_out[i] = NULL;
+    }
+    return ret != 0 || stream->stopped ? 1 : 0;
+}
+
+void Kirb_stream_close(KirbStream *stream)
+{
+    if(stream == NULL)
+        return;
+    kirb_release(stream->ctx, stream);
+}
@@ -0,0 +1,907 @@
+// kirbtable.c
+// Compiled rules, parser contexts and the single pass engine
+
+#include "kirbparse.h"
+#include "kirbparse_internal.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+
+// File-scope helper functions
+static size_t table_size(const KirbTable *table);
+static int table_insert(KirbTable *table, const char *name, int *names_used);
+static int crossover_counts(const KirbTable *table, char opt, int slot, const struct tally *tally);
+static void tally_stats(const KirbTable *table, const struct tally *tally, KirbStats *stats);
+static void context_from_globals(KirbContext *ctx, const KirbTable *table, int allow_crossover);
+static int prep_ctx(int argc, char **argv, const KirbContext *ctx);
+static int mark_ctx(int argc, char **argv, const KirbContext *ctx, enum Mark *marks);
+static int mark_compact_ctx(int argc, char **argv, const KirbContext *ctx, uint8_t *marks);
+KIRB_INLINE int prep_pass(int argc, char **argv, const KirbContext *ctx, KirbStats *stats);
+KIRB_INLINE int mark_pass(int argc, char **argv, const KirbContext *ctx, enum Mark *marks, uint8_t *compact_marks,
+                          KirbStats *stats);
+KIRB_INLINE int walk_arg(struct walk *walk, char *arg, uint64_t *flag_bits, KirbStats *stats);
+static int parse_table_ctx(int argc, char **argv, const KirbContext *ctx,
+                           int *flags_out, char **values_out, int *num_anon, char ***anon_out);
+static int fused_core(int argc, char **argv, const KirbContext *ctx, int *flags_out, uint64_t *flag_bits,
+                      char **values_out, char **anon, int anon_capacity, int *num_anon);
+KIRB_INLINE int fused_pass(int argc, char **argv, const KirbContext *ctx, int *flags_out, uint64_t *flag_bits,
+                           char **values_out, char **anon, int anon_capacity, int *num_anon, KirbStats *stats);
+static int parse_fused_ctx(int argc, char **argv, const KirbContext *ctx, int *flags_out, uint64_t *flag_bits,
+                           char **values_out, int *num_anon, char ***anon_out);
+
+int Kirb_compile(KirbTable *table,
+                 int num_flags, char *flags, char **flags_long,
+                 int num_value_opts, char *value_opts, char **value_opts_long,
+                 int infer)
+{
+    if(table == NULL || num_flags < 0 || num_value_opts < 0)
+        return -1;
+    if((num_flags > 0 && (flags == NULL || flags_long == NULL)) ||
+       (num_value_opts > 0 && (value_opts == NULL || value_opts_long == NULL)))
+        return -1; // Nothing to compile from (or infer into)
+
+    if(infer == 1) // Same inference as Kirb_prep, so the caller's lists stay in sync with the table
+    {
+        for(int i = 0; i < num_flags; ++i)
+            flags[i] = flags_long[i][0];
+        for(int i = 0; i < num_value_opts; ++i)
+            value_opts[i] = value_opts_long[i][0];
+    }
+
+    int num_slots = 1;
+    while(num_slots < 2 * (num_flags + num_value_opts))
+        num_slots <<= 1;
+    int names_size = 0;
+    for(int i = 0; i < num_flags; ++i)
+        names_size += ((int) strlen(flags_long[i]) + KIRB_NAME_ALIGN) / KIRB_NAME_ALIGN * KIRB_NAME_ALIGN;
+    for(int i = 0; i < num_value_opts; ++i)
+        names_size += ((int) strlen(value_opts_long[i]) + KIRB_NAME_ALIGN) / KIRB_NAME_ALIGN * KIRB_NAME_ALIGN;
+
+    // The distinct long names in order, which is how the trie gets built
+    int num_names = num_flags + num_value_opts;
+    const char **sorted = malloc((num_names > 0 ? num_names : 1) * sizeof(char*));
+    if(sorted == NULL)
+        return -1;
+    for(int i = 0; i < num_flags; ++i)
+        sorted[i] = flags_long[i];
+    for(int i = 0; i < num_value_opts; ++i)
+        sorted[num_flags + i] = value_opts_long[i];
+
+    table->num_flags = num_flags;
+    table->num_value_opts = num_value_opts;
+    table->num_slots = num_slots;
+    table->names_size = names_size;
+    table->num_nodes = kirb_trie_sort(sorted, &num_names);
+    table->block = malloc(table_size(table));
+    if(table->block == NULL)
+    {
+        free(sorted);
+        return -1;
+    }
+    kirb_table_layout(table);
+    table->source = KIRB_SOURCE_COMPILED;
+    // Nothing is left uninitialised, so a saved table is the same bytes every time
+    memset(table->labels + table->num_nodes, 0, table->names - (char*) (table->labels + table->num_nodes));
+
+    for(int i = 0; i < 256; ++i)
+    {
+        table->short_flag[i] = -1;
+        table->short_value[i] = -1;
+    }
+    for(int i = 0; i < num_slots; ++i)
+    {
+        table->slots[i].hash = 0;
+        table->slots[i].name = -1;
+        table->slots[i].flag = -1;
+        table->slots[i].value = -1;
+    }
+    memset(table->names, 0, names_size); // The padding after each name
+
+    // Insert in rule order and never overwrite, so the first matching rule wins just like match_short/match_long
+    int names_used = 0;
+    for(int i = 0; i < num_flags; ++i)
+    {
+        table->flag_short[i] = flags[i];
+        if(flags[i] != '\0' && table->short_flag[(unsigned char) flags[i]] == -1)
+            table->short_flag[(unsigned char) flags[i]] = i;
+
+        int s = table_insert(table, flags_long[i], &names_used);
+        table->flag_slot[i] = s;
+        if(table->slots[s].flag == -1)
+            table->slots[s].flag = i;
+    }
+    for(int i = 0; i < num_value_opts; ++i)
+    {
+        table->value_short[i] = value_opts[i];
+        if(value_opts[i] != '\0' && table->short_value[(unsigned char) value_opts[i]] == -1)
+            table->short_value[(unsigned char) value_opts[i]] = i;
+
+        int s = table_insert(table, value_opts_long[i], &names_used);
+        table->value_slot[i] = s;
+        if(table->slots[s].value == -1)
+            table->slots[s].value = i;
+    }
+    table->names_size = names_used;
+    table->block_size = (size_t) (table->names - (char*) table->block) + names_used;
+    kirb_trie_build(table, sorted, num_names);
+    free(sorted);
+
+    return 0;
+}
+
+void Kirb_free_table(KirbTable *table)
+{
+    if(table == NULL)
+        return;
+    if(table->source == KIRB_SOURCE_MAPPED)
+        kirb_unmap_table(table);
+    else if(table->source == KIRB_SOURCE_COMPILED)
+        free(table->block);
+    table->block = NULL;
+}
+
+int Kirb_context_init(KirbContext *ctx, FILE *info, FILE *err,
+                      int num_flags, char *flags, char **flags_long,
+                      int num_value_opts, char *value_opts, char **value_opts_long,
+                      int infer, int allow_crossover)
+{
+    if(ctx == NULL)
+        return -1;
+    ctx->info = info;
+    ctx->err = err;
+    ctx->debug = 0;
+    ctx->werror = 0;
+    ctx->allow_crossover = allow_crossover;
+    ctx->alloc = NULL;
+    ctx->release = NULL;
+    ctx->alloc_user = NULL;
+    ctx->stats = NULL;
+    ctx->trace = NULL;
+    ctx->conflicts = NULL;
+    ctx->num_conflicts = 0;
+    return Kirb_compile(&ctx->table,
+                        num_flags, flags, flags_long,
+                        num_value_opts, value_opts, value_opts_long,
+                        infer);
+}
+
+void Kirb_context_free(KirbContext *ctx)
+{
+    if(ctx == NULL)
+        return;
+    Kirb_free_table(&ctx->table);
+}
+
+int Kirb_prep_ctx(int argc, char **argv, const KirbContext *ctx)
+{
+    if(kirb_check_context(ctx) == -1)
+        return -1;
+    return prep_ctx(argc, argv, ctx);
+}
+
+int Kirb_mark_ctx(int argc, char **argv, const KirbContext *ctx, enum Mark *marks)
+{
+    if(kirb_check_context(ctx) == -1)
+        return -1;
+    return mark_ctx(argc, argv, ctx, marks);
+}
+
+int Kirb_mark_compact_ctx(int argc, char **argv, const KirbContext *ctx, uint8_t *marks)
+{
+    if(kirb_check_context(ctx) == -1)
+        return -1;
+    return mark_compact_ctx(argc, argv, ctx, marks);
+}
+
+int Kirb_parse_all_ctx(int argc, char **argv, const KirbContext *ctx,
+                       int *flags_out, char **values_out, int *num_anon, char ***anon_out)
+{
+    if(kirb_check_context(ctx) == -1)
+        return -1;
+    return parse_fused_ctx(argc, argv, ctx, flags_out, NULL, values_out, num_anon, anon_out);
+}
+
+int Kirb_parse_bits(int argc, char **argv, const KirbContext *ctx,
+                    uint64_t *flag_bits, char **values_out, int *num_anon, char ***anon_out)
+{
+    if(kirb_check_context(ctx) == -1 || (ctx->table.num_flags > 0 && flag_bits == NULL))
+        return -1;
+    return parse_fused_ctx(argc, argv, ctx, NULL, flag_bits, values_out, num_anon, anon_out);
+}
+
+int Kirb_parse_arena(int argc, char **argv, const KirbContext *ctx, void *arena, size_t arena_size,
+                     KirbResult *result)
+{
+    if(kirb_check_context(ctx) == -1 || result == NULL || (arena == NULL && arena_size > 0))
+        return -1;
+
+    // Values, then flags, then as much of an anonymous list as fits, each aligned for what it holds
+    const KirbTable *table = &ctx->table;
+    uintptr_t base = (uintptr_t) arena;
+    uintptr_t values = (base + sizeof(char*) - 1) / sizeof(char*) * sizeof(char*);
+    uintptr_t flags = values + table->num_value_opts * sizeof(char*);
+    uintptr_t anon = (flags + table->num_flags * sizeof(int) + sizeof(char*) - 1) / sizeof(char*) * sizeof(char*);
+    if(anon - base > arena_size)
+    {
+        if(ctx->debug)
+            fprintf(kirb_err(ctx), "ERROR: KIRBPARSE: Arena of %zu bytes can't hold the flags and values\n",
+                    arena_size);
+        return -2;
+    }
+
+    result->values = (char**) values;
+    result->flags = (int*) flags;
+    result->anon = (char**) anon;
+    size_t room = (arena_size - (anon - base)) / sizeof(char*);
+    int capacity = room > (size_t) INT_MAX ? INT_MAX : (int) room;
+    result->num_anon = 0;
+
+    int ret = fused_core(argc, argv, ctx, result->flags, NULL, result->values, result->anon, capacity,
+                         &result->num_anon);
+    if(ret == -2 && ctx->debug)
+        fprintf(kirb_err(ctx), "ERROR: KIRBPARSE: Arena of %zu bytes ran out of room for anonymous values\n",
+                arena_size);
+    return ret;
+}
+
+size_t Kirb_arena_size(int argc, const KirbContext *ctx)
+{
+    if(kirb_check_context(ctx) == -1 || argc < 1)
+        return 0;
+    // Worst case for both alignment gaps in Kirb_parse_arena, and every argument but the first anonymous
+    return 2 * (sizeof(char*) - 1)
+           + ctx->table.num_value_opts * sizeof(char*)
+           + ctx->table.num_flags * sizeof(int)
+           + (argc > 1 ? argc - 1 : 0) * sizeof(char*);
+}
+
+void Kirb_free_anon(const KirbContext *ctx, char **anon)
+{
+    if(ctx == NULL)
+        free(anon);
+    else
+        kirb_release(ctx, anon);
+}
+
+void *kirb_alloc(const KirbContext *ctx, size_t size)
+{
+    return ctx->alloc != NULL ? ctx->alloc(size, ctx->alloc_user) : malloc(size);
+}
+
+void kirb_release(const KirbContext *ctx, void *ptr)
+{
+    if(ctx->release != NULL)
+        ctx->release(ptr, ctx->alloc_user);
+    else
+        free(ptr);
+}
+
+// The table functions are the context ones run with the global settings
+
+int Kirb_prep_table(int argc, char **argv, const KirbTable *table, int allow_crossover)
+{
+    KirbContext ctx;
+    if(table == NULL || table->block == NULL)
+        return -1;
+    context_from_globals(&ctx, table, allow_crossover);
+    return prep_ctx(argc, argv, &ctx);
+}
+
+int Kirb_mark_table(int argc, char **argv, const KirbTable *table, enum Mark *marks)
+{
+    KirbContext ctx;
+    if(table == NULL || table->block == NULL)
+        return -1;
+    context_from_globals(&ctx, table, 0);
+    return mark_ctx(argc, argv, &ctx, marks);
+}
+
+int Kirb_parse_table(int argc, char **argv, const KirbTable *table, int allow_crossover,
+                     int *flags_out, char **values_out, int *num_anon, char ***anon_out)
+{
+    KirbContext ctx;
+    if(table == NULL || table->block == NULL)
+        return -1;
+    for(int i = 0; i < table->num_flags; ++i)
+        flags_out[i] = 0;
+    for(int i = 0; i < table->num_value_opts; ++i)
+        values_out[i] = NULL;
+    if(kirb_check_sinks() == -1)
+        return -1;
+    context_from_globals(&ctx, table, allow_crossover);
+    return parse_table_ctx(argc, argv, &ctx, flags_out, values_out, num_anon, anon_out);
+}
+
+int Kirb_parse_fused(int argc, char **argv, const KirbTable *table, int allow_crossover,
+                     int *flags_out, char **values_out, int *num_anon, char ***anon_out)
+{
+    KirbContext ctx;
+    if(table == NULL || table->block == NULL)
+        return -1;
+    for(int i = 0; i < table->num_flags; ++i)
+        flags_out[i] = 0;
+    for(int i = 0; i < table->num_value_opts; ++i)
+        values_out[i] = NULL;
+    if(kirb_check_sinks() == -1)
+        return -1;
+    context_from_globals(&ctx, table, allow_crossover);
+    return parse_fused_ctx(argc, argv, &ctx, flags_out, NULL, values_out, num_anon, anon_out);
+}
+
+FILE *kirb_err(const KirbContext *ctx)
+{
+    return ctx->err != NULL ? ctx->err : stderr;
+}
+
+// Kirb_prep's crossover and duplicate checks, in the same order and with the same outcomes, from the tallies
+// Value options are left out unless check_values is set
+int kirb_check_tally(const KirbContext *ctx, const struct tally *tally, int check_values)
+{
+    const KirbTable *table = &ctx->table;
+
+    if(ctx->debug)
+        kirb_event(ctx, EVENT_BEGIN_CROSSOVER, -1, NULL);
+    int ret;
+    for(int i = 0; i < table->num_flags; ++i)
+    {
+        ret = crossover_counts(table, table->flag_short[i], table->flag_slot[i], tally);
+
+        if(ret == 1)
+        {
+            if(ctx->debug)
+                kirb_event(ctx, EVENT_CROSSOVER, -1, NULL);
+            return ret;
+        }
+        else if(ret > 1)
+        {
+            if(ctx->werror)
+            {
+                kirb_event(ctx, EVENT_DUPLICATE_FLAG_ERROR, -1, NULL);
+                return 1;
+            }
+            if(ctx->debug)
+            {
+                kirb_event(ctx, EVENT_DUPLICATE_FLAG, -1, NULL);
+                return 2;
+            }
+        }
+    }
+    for(int i = 0; check_values && i < table->num_value_opts; ++i)
+    {
+        ret = crossover_counts(table, table->value_short[i], table->value_slot[i], tally);
+
+        if(ret == 1)
+        {
+            if(ctx->debug)
+                kirb_event(ctx, EVENT_CROSSOVER, -1, NULL);
+            return ret;
+        }
+        else if(ret > 1)
+        {
+            if(ctx->debug)
+                kirb_event(ctx, EVENT_DUPLICATE_VALUE, -1, NULL);
+            return 1;
+        }
+    }
+    if(ctx->debug)
+        kirb_event(ctx, EVENT_END_CROSSOVER, -1, NULL);
+
+    return 0;
+}
+
+// Start a tally at zero, counting long names into the num_slots ints at slot_count
+void kirb_tally_begin(struct tally *tally, int *slot_count, int num_slots)
+{
+    memset(tally, 0, sizeof(*tally));
+    memset(slot_count, 0, num_slots * sizeof(int));
+    tally->slot_count = slot_count;
+}
+
+void kirb_walk_begin(struct walk *walk, const KirbContext *ctx, struct tally *tally,
+                     int *flags_out, char **values_out)
+{
+    walk->ctx = ctx;
+    walk->table = &ctx->table;
+    walk->tally = ctx->allow_crossover == 0 ? tally : NULL;
+    walk->flags_out = flags_out;
+    walk->values_out = values_out;
+    walk->position = 0;
+    walk->takes_value = 0;
+    walk->pending = -1;
+}
+
+// Classify, resolve and record one argument, returning its Mark
+// Returns -1 if a value option is left without its value, which is where Kirb_parse_all would stop. The pending
+//  value option is kept so kirb_walk_end reports it too
+int kirb_walk_arg(struct walk *walk, char *arg)
+{
+    return walk_arg(walk, arg, NULL, NULL);
+}
+
+// kirb_walk_arg, setting flags in flag_bits instead of walk->flags_out unless it's NULL, and counting into stats
+//  unless that's NULL
+KIRB_INLINE int walk_arg(struct walk *walk, char *arg, uint64_t *flag_bits, KirbStats *stats)
+{
+    const KirbTable *table = walk->table;
+    int mark;
+
+    if(stats != NULL)
+        ++stats->visits;
+    if(arg[0] == '-')
+    {
+        if(walk->tally != NULL)
+        {
+            kirb_count_arg(table, arg, walk->tally);
+            if(stats != NULL)
+                ++stats->matches;
+        }
+        if(walk->position == 0)
+            mark = PROGRAM;
+        else
+        {
+            if(walk->pending != -1)
+                return -1;
+
+            int f = kirb_flag(table, arg);
+            if(f > -1 && flag_bits != NULL)
+                flag_bits[f >> 6] |= (uint64_t) 1 << (f & 63);
+            else if(f > -1)
+                walk->flags_out[f] = 1;
+            else
+                walk->pending = kirb_value(table, arg);
+            mark = arg[1] == '-' ? OPTION_LONG : OPTION_SHORT;
+            if(stats != NULL)
+                stats->matches += f > -1 ? 1 : 2;
+        }
+        walk->takes_value = kirb_takes_value(table, arg);
+        if(stats != NULL)
+            ++stats->matches;
+    }
+    else
+    {
+        if(walk->position == 0)
+            mark = PROGRAM;
+        else if(walk->takes_value)
+        {
+            if(walk->pending != -1)
+                walk->values_out[walk->pending] = arg;
+            walk->pending = -1;
+            mark = VALUE;
+        }
+        else
+            mark = ANONYMOUS;
+        walk->takes_value = 0;
+    }
+
+    if(stats != NULL)
+    {
+        stats->shorts += mark == OPTION_SHORT;
+        stats->longs += mark == OPTION_LONG;
+        stats->values += mark == VALUE;
+        stats->anonymous += mark == ANONYMOUS;
+    }
+    ++walk->position;
+    return mark;
+}
+
+// Finish the pass: the Kirb_prep result if it's an error, otherwise -2 if a value option never got its value
+int kirb_walk_end(struct walk *walk)
+{
+    if(walk->tally != NULL && kirb_check_tally(walk->ctx, walk->tally, 1) == 1)
+        return 1;
+    if(walk->pending != -1)
+        return -2;
+    return 0;
+}
+
+// Bytes needed for the block backing a table with the counts already filled in
+static size_t table_size(const KirbTable *table)
+{
+    return 2 * 256 * sizeof(int)
+           + table->num_slots * sizeof(struct KirbSlot)
+           + table->num_nodes * (sizeof(struct KirbNode) + 1)
+           + (table->num_flags + table->num_value_opts) * (sizeof(int) + 1)
+           + KIRB_NAME_ALIGN - 1 + table->names_size;
+}
+
+// Point the table's arrays into its block, which is laid out from the counts alone
+void kirb_table_layout(KirbTable *table)
+{
+    char *at = table->block;
+    table->short_flag = (int*) at;
+    at += 256 * sizeof(int);
+    table->short_value = (int*) at;
+    at += 256 * sizeof(int);
+    table->slots = (struct KirbSlot*) at;
+    at += table->num_slots * sizeof(struct KirbSlot);
+    table->nodes = (struct KirbNode*) at;
+    at += table->num_nodes * sizeof(struct KirbNode);
+    table->flag_slot = (int*) at;
+    at += table->num_flags * sizeof(int);
+    table->value_slot = (int*) at;
+    at += table->num_value_opts * sizeof(int);
+    table->flag_short = at;
+    at += table->num_flags;
+    table->value_short = at;
+    at += table->num_value_opts;
+    table->labels = (unsigned char*) at;
+    at += table->num_nodes;
+    at += (KIRB_NAME_ALIGN - (at - (char*) table->block) % KIRB_NAME_ALIGN) % KIRB_NAME_ALIGN;
+    table->names = at;
+}
+
+// Slot for name, adding it to the pool if it isn't there yet
+static int table_insert(KirbTable *table, const char *name, int *names_used)
+{
+    unsigned int hash = kirb_hash(name);
+    int s = kirb_probe(table, name, hash);
+    if(table->slots[s].name == -1)
+    {
+        size_t len = strlen(name) + 1;
+        memcpy(table->names + *names_used, name, len);
+        table->slots[s].hash = hash;
+        table->slots[s].name = *names_used;
+        *names_used += (int) ((len + KIRB_NAME_ALIGN - 1) / KIRB_NAME_ALIGN * KIRB_NAME_ALIGN);
+    }
+    return s;
+}
+
+// crossover_check for one rule, using the tallies from kirb_count_arg
+static int crossover_counts(const KirbTable *table, char opt, int slot, const struct tally *tally)
+{
+    int opt_present = tally->short_count[(unsigned char) opt];
+    int long_present = tally->slot_count[slot];
+    if(table->names[table->slots[slot].name] == '\0' && opt != '-')
+        long_present += tally->dashdash;
+
+    if(opt_present && long_present)
+        return 1;
+    if(opt_present > 1 || long_present > 1)
+        return 2;
+    return 0;
+}
+
+// Count every duplicate and crossover in the tallies, where kirb_check_tally stops at the first that decides
+static void tally_stats(const KirbTable *table, const struct tally *tally, KirbStats *stats)
+{
+    int ret;
+    for(int i = 0; i < table->num_flags + table->num_value_opts; ++i)
+    {
+        if(i < table->num_flags)
+            ret = crossover_counts(table, table->flag_short[i], table->flag_slot[i], tally);
+        else
+            ret = crossover_counts(table, table->value_short[i - table->num_flags],
+                                   table->value_slot[i - table->num_flags], tally);
+        stats->crossovers += ret == 1;
+        stats->duplicates += ret == 2;
+    }
+}
+
+// Borrow the global settings for the table functions, which predate contexts
+static void context_from_globals(KirbContext *ctx, const KirbTable *table, int allow_crossover)
+{
+    ctx->info = kirbparse_info;
+    ctx->err = kirbparse_err;
+    ctx->debug = kirbparse_debug;
+    ctx->werror = kirbparse_werror;
+    ctx->allow_crossover = allow_crossover;
+    ctx->alloc = NULL;
+    ctx->release = NULL;
+    ctx->alloc_user = NULL;
+    ctx->stats = NULL;
+    ctx->trace = NULL;
+    ctx->conflicts = NULL;
+    ctx->num_conflicts = 0;
+    ctx->table = *table;
+}
+
+// Context equivalent of kirb_check_sinks, which can't fall back by changing the context
+int kirb_check_context(const KirbContext *ctx)
+{
+    if(ctx == NULL || ctx->table.block == NULL)
+        return -1;
+    if(ctx->info == NULL)
+    {
+        fprintf(kirb_err(ctx), "KIRBPARSE ERROR: information logging file not specified. "
+                               "If this is intended, set info to stdout.\n");
+        return -1;
+    }
+    if(ctx->err == NULL && ctx->werror)
+    {
+        fprintf(stderr, "ERROR: KIRBPARSE: error logging file not specified. "
+                        "If this is intended, set err to stderr.\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int prep_ctx(int argc, char **argv, const KirbContext *ctx)
+{
+    if(ctx->stats == NULL)
+        return prep_pass(argc, argv, ctx, NULL);
+    return prep_pass(argc, argv, ctx, ctx->stats);
+}
+
+KIRB_INLINE int prep_pass(int argc, char **argv, const KirbContext *ctx, KirbStats *stats)
+{
+    if(ctx->allow_crossover != 0)
+        return 0;
+
+    uint64_t start = stats != NULL ? kirb_now_ns() : 0;
+    // One walk over argv, counting every short character and long name that shows up
+    struct tally tally;
+    int slot_count[ctx->table.num_slots];
+    kirb_tally_begin(&tally, slot_count, ctx->table.num_slots);
+    for(int i = 0; i < argc; ++i)
+    {
+        if(argv[i][0] == '-')
+        {
+            kirb_count_arg(&ctx->table, argv[i], &tally);
+            if(stats != NULL)
+                ++stats->matches;
+        }
+    }
+
+    int ret = kirb_check_tally(ctx, &tally, 1);
+    if(stats != NULL)
+    {
+        tally_stats(&ctx->table, &tally, stats);
+        stats->visits += argc;
+        stats->prep_ns += kirb_now_ns() - start;
+    }
+    return ret;
+}
+
+static int mark_ctx(int argc, char **argv, const KirbContext *ctx, enum Mark *marks)
+{
+    if(ctx->stats == NULL)
+        return mark_pass(argc, argv, ctx, marks, NULL, NULL);
+    return mark_pass(argc, argv, ctx, marks, NULL, ctx->stats);
+}
+
+static int mark_compact_ctx(int argc, char **argv, const KirbContext *ctx, uint8_t *marks)
+{
+    if(ctx->stats == NULL)
+        return mark_pass(argc, argv, ctx, NULL, marks, NULL);
+    return mark_pass(argc, argv, ctx, NULL, marks, ctx->stats);
+}
+
+// Marks go to whichever of marks and compact_marks isn't NULL
+KIRB_INLINE int mark_pass(int argc, char **argv, const KirbContext *ctx, enum Mark *marks, uint8_t *compact_marks,
+                          KirbStats *stats)
+{
+    int num_anon = 0;
+
+    if(marks == NULL && compact_marks == NULL)
+    {
+        if(ctx->debug)
+            kirb_event(ctx, EVENT_NO_MARKS, -1, NULL);
+        return -1;
+    }
+    uint64_t start = stats != NULL ? kirb_now_ns() : 0;
+    if(marks != NULL)
+        marks[0] = PROGRAM;
+    else
+        compact_marks[0] = PROGRAM;
+
+    for(int i = 1; i < argc; ++i)
+    {
+        enum Mark mark = kirb_mark_one(&ctx->table, argv, i);
+        if(marks != NULL)
+            marks[i] = mark;
+        else
+            compact_marks[i] = (uint8_t) mark;
+        if(mark == ANONYMOUS)
+            ++num_anon;
+        if(stats != NULL)
+        {
+            stats->matches += mark == VALUE || mark == ANONYMOUS;
+            stats->shorts += mark == OPTION_SHORT;
+            stats->longs += mark == OPTION_LONG;
+            stats->values += mark == VALUE;
+            stats->anonymous += mark == ANONYMOUS;
+        }
+    }
+    if(stats != NULL)
+    {
+        stats->visits += argc;
+        stats->mark_ns += kirb_now_ns() - start;
+    }
+    return num_anon;
+}
+
+// The three phases one after another, like Kirb_parse_all
+static int parse_table_ctx(int argc, char **argv, const KirbContext *ctx,
+                           int *flags_out, char **values_out, int *num_anon, char ***anon_out)
+{
+    const KirbTable *table = &ctx->table;
+    int prep_ret, mark_ret;
+    uint8_t stack_marks[KIRB_STACK_MARKS];
+    uint8_t *marks = stack_marks; // On the heap when there are too many for the stack
+
+    prep_ret = prep_ctx(argc, argv, ctx);
+    if(prep_ret == -1)
+        return -1;
+    else if(prep_ret == 1)
+    {
+        if(ctx->debug)
+            kirb_event(ctx, EVENT_PREP_ERROR, -1, NULL);
+        return 1;
+    }
+
+    if(argc > KIRB_STACK_MARKS && (marks = kirb_alloc(ctx, argc)) == NULL)
+        return -1;
+    mark_ret = mark_compact_ctx(argc, argv, ctx, marks);
+    if(mark_ret == -1)
+        return -1;
+
+    int f, v;
+    for(int i = 1; i < argc; ++i)
+    {
+        if(marks[i] != OPTION_SHORT && marks[i] != OPTION_LONG)
+            continue;
+
+        f = kirb_flag(table, argv[i]);
+        v = kirb_value(table, argv[i]);
+        if(f > -1)
+        {
+            if(ctx->debug)
+                kirb_event(ctx, EVENT_FOUND_FLAG, i, argv[i]);
+            flags_out[f] = 1;
+        }
+        else if(v > -1)
+        {
+            if(ctx->debug)
+                kirb_event(ctx, EVENT_FOUND_VALUE, i, argv[i]);
+
+            if(i + 1 < argc && marks[i + 1] == VALUE)
+                values_out[v] = argv[++i]; // add and skip the value
+            else
+            {
+                if(ctx->debug)
+                    kirb_event(ctx, EVENT_MISSING_VALUE, i, NULL);
+                if(marks != stack_marks)
+                    kirb_release(ctx, marks);
+                return 1;
+            }
+        }
+    }
+
+    *anon_out = kirb_alloc(ctx, mark_ret * sizeof(char*));
+    if(*anon_out == NULL && mark_ret > 0)
+    {
+        if(marks != stack_marks)
+            kirb_release(ctx, marks);
+        return -1;
+    }
+    *num_anon = mark_ret;
+    int place_in_anon = 0;
+    for(int i = 1; i < argc; ++i)
+    {
+        if(marks[i] == ANONYMOUS)
+            (*anon_out)[place_in_anon++] = argv[i];
+    }
+
+    if(marks != stack_marks)
+        kirb_release(ctx, marks);
+    return 0;
+}
+
+// All three phases while visiting each argument once, with the anonymous values going to the caller's array
+// Returns -2 without finishing if more than anon_capacity anonymous values turn up
+// Flags go to whichever of flags_out and flag_bits isn't NULL
+static int fused_core(int argc, char **argv, const KirbContext *ctx, int *flags_out, uint64_t *flag_bits,
+                      char **values_out, char **anon, int anon_capacity, int *num_anon)
+{
+    if(ctx->stats == NULL && flag_bits == NULL)
+        return fused_pass(argc, argv, ctx, flags_out, NULL, values_out, anon, anon_capacity, num_anon, NULL);
+    if(ctx->stats == NULL)
+        return fused_pass(argc, argv, ctx, NULL, flag_bits, values_out, anon, anon_capacity, num_anon, NULL);
+
+    uint64_t start = kirb_now_ns();
+    int ret = fused_pass(argc, argv, ctx, flags_out, flag_bits, values_out, anon, anon_capacity, num_anon,
+                         ctx->stats);
+    ctx->stats->parse_ns += kirb_now_ns() - start;
+    return ret;
+}
+
+KIRB_INLINE int fused_pass(int argc, char **argv, const KirbContext *ctx, int *flags_out, uint64_t *flag_bits,
+                           char **values_out, char **anon, int anon_capacity, int *num_anon, KirbStats *stats)
+{
+    const KirbTable *table = &ctx->table;
+
+    if(flag_bits != NULL)
+        memset(flag_bits, 0, KIRB_FLAG_WORDS(table->num_flags) * sizeof(uint64_t));
+    else
+    {
+        for(int i = 0; i < table->num_flags; ++i)
+            flags_out[i] = 0;
+    }
+    for(int i = 0; i < table->num_value_opts; ++i)
+        values_out[i] = NULL;
+
+    struct tally tally;
+    int slot_count[table->num_slots];
+    kirb_tally_begin(&tally, slot_count, table->num_slots);
+
+    struct walk walk;
+    kirb_walk_begin(&walk, ctx, &tally, flags_out, values_out);
+    int count = 0, i;
+    for(i = 0; i < argc; ++i)
+    {
+        int mark = walk_arg(&walk, argv[i], flag_bits, stats);
+        if(mark == ANONYMOUS)
+        {
+            if(count == anon_capacity)
+                return -2;
+            anon[count++] = argv[i];
+        }
+        else if(mark == -1)
+            break; // Kirb_parse_all stops extracting at the same argument
+    }
+    // Prep errors still win over a missing value, so the rest only needs counting
+    for(++i; i < argc && walk.tally != NULL; ++i)
+    {
+        if(argv[i][0] == '-')
+            kirb_count_arg(table, argv[i], &tally);
+        if(stats != NULL)
+        {
+            ++stats->visits;
+            stats->matches += argv[i][0] == '-';
+        }
+    }
+
+    if(stats != NULL && walk.tally != NULL)
+        tally_stats(table, &tally, stats);
+    int ret = kirb_walk_end(&walk);
+    if(ret == 1)
+    {
+        // Prep would have stopped Kirb_parse_all before anything was written
+        if(flag_bits != NULL)
+            memset(flag_bits, 0, KIRB_FLAG_WORDS(table->num_flags) * sizeof(uint64_t));
+        else
+        {
+            for(int j = 0; j < table->num_flags; ++j)
+                flags_out[j] = 0;
+        }
+        for(int j = 0; j < table->num_value_opts; ++j)
+            values_out[j] = NULL;
+        return 1;
+    }
+    if(ret == -2)
+    {
+        if(ctx->debug)
+            kirb_event(ctx, EVENT_MISSING_VALUE, -1, NULL);
+        return 1;
+    }
+
+    *num_anon = count;
+    return 0;
+}
+
+static int parse_fused_ctx(int argc, char **argv, const KirbContext *ctx, int *flags_out, uint64_t *flag_bits,
+                           char **values_out, int *num_anon, char ***anon_out)
+{
+    if(*anon_out != NULL)
+    {
+        if(ctx->debug)
+            kirb_event(ctx, EVENT_ANON_NOT_NULL, -1, NULL);
+    }
+
+    // Anonymous values can't outnumber the arguments, so one allocation covers them without a counting pass
+    int capacity = argc > 1 ? argc - 1 : 1;
+    char **anon = kirb_alloc(ctx, capacity * sizeof(char*));
+    if(anon == NULL)
+        return -1;
+
+    int ret = fused_core(argc, argv, ctx, flags_out, flag_bits, values_out, anon, capacity, num_anon);
+    if(ret != 0)
+    {
+        kirb_release(ctx, anon);
+        return ret;
+    }
+    *anon_out = anon;
+    return 0;
+}
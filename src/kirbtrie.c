@@ -0,0 +1,345 @@
+// kirbtrie.c
+// The long names as a prefix trie, for abbreviations, and the parse that accepts them along with attached values
+
+#include "kirbparse.h"
+#include "kirbparse_internal.h"
+#include <stdlib.h>
+
+// File-scope types
+// What one dashed argument comes to under the extended syntax
+struct resolved
+{
+    int flag;        // Flag it sets, -1 if none
+    int value;       // Value option it sets, -1 if none
+    char *attached;  // Value given in the same argument, NULL if it's the next one
+    int takes_value; // Whether the mark phase would call the next argument a value
+    int short_char;  // Short option counted for the crossover check, -1 if none
+    int slot;        // Long name counted for the crossover check, -1 if none
+};
+
+// File-scope helper functions
+static int compare_names(const void *a, const void *b);
+static void build_node(KirbTable *table, int node, const char **names, int count, size_t depth, int *used);
+static int slot_of(const KirbTable *table, const char *name);
+static int trie_find(const KirbTable *table, const char *name, const char **end);
+static int resolve(const KirbTable *table, char *arg, struct resolved *r);
+static void count_arg(const KirbTable *table, char *arg, const struct resolved *r, struct tally *tally);
+static int extended_arg(struct walk *walk, char *arg, int *error);
+
+// Sort the long names and drop repeats, returning how many trie nodes they take
+// Each name adds a node for every character past what it shares with the name before it
+int kirb_trie_sort(const char **names, int *count)
+{
+    qsort(names, *count, sizeof(char*), compare_names);
+
+    int kept = 0, num_nodes = 1;
+    for(int i = 0; i < *count; ++i)
+    {
+        size_t common = 0;
+        if(kept > 0)
+        {
+            while(names[i][common] != '\0' && names[i][common] == names[kept - 1][common])
+                ++common;
+            if(names[i][common] == '\0' && names[kept - 1][common] == '\0')
+                continue;
+        }
+        num_nodes += (int) (strlen(names[i]) - common);
+        names[kept++] = names[i];
+    }
+    *count = kept;
+    return num_nodes;
+}
+
+// Fill in table->nodes from the names kirb_trie_sort left, after they're in the hash
+void kirb_trie_build(KirbTable *table, const char **names, int count)
+{
+    int used = 1;
+    table->labels[0] = '\0';
+    build_node(table, 0, names, count, 0, &used);
+}
+
+int Kirb_parse_extended(int argc, char **argv, const KirbContext *ctx,
+                        int *flags_out, char **values_out, int *num_anon, char ***anon_out)
+{
+    if(kirb_check_context(ctx) == -1 || argc < 1 || argv == NULL || num_anon == NULL || anon_out == NULL)
+        return -1;
+    if(*anon_out != NULL)
+    {
+        if(ctx->debug)
+            kirb_event(ctx, EVENT_ANON_NOT_NULL, -1, NULL);
+    }
+
+    const KirbTable *table = &ctx->table;
+    for(int i = 0; i < table->num_flags; ++i)
+        flags_out[i] = 0;
+    for(int i = 0; i < table->num_value_opts; ++i)
+        values_out[i] = NULL;
+
+    int capacity = argc > 1 ? argc - 1 : 1;
+    char **anon = kirb_alloc(ctx, capacity * sizeof(char*));
+    if(anon == NULL)
+        return -1;
+
+    struct tally tally;
+    int slot_count[table->num_slots];
+    kirb_tally_begin(&tally, slot_count, table->num_slots);
+
+    struct walk walk;
+    kirb_walk_begin(&walk, ctx, &tally, flags_out, values_out);
+    int count = 0, error = 0, i;
+    for(i = 0; i < argc; ++i)
+    {
+        int mark = extended_arg(&walk, argv[i], &error);
+        if(mark == ANONYMOUS)
+            anon[count++] = argv[i];
+        else if(mark == -1)
+            break;
+    }
+    // Prep errors still win over anything found while extracting, so the rest only needs counting
+    for(++i; i < argc && walk.tally != NULL; ++i)
+    {
+        struct resolved r;
+        if(argv[i][0] == '-')
+        {
+            resolve(table, argv[i], &r);
+            count_arg(table, argv[i], &r, &tally);
+        }
+    }
+
+    int ret = kirb_walk_end(&walk);
+    if(ret == 1)
+    {
+        for(int j = 0; j < table->num_flags; ++j)
+            flags_out[j] = 0;
+        for(int j = 0; j < table->num_value_opts; ++j)
+            values_out[j] = NULL;
+        kirb_release(ctx, anon);
+        return 1;
+    }
+    if(error != 0 || ret == -2)
+    {
+        if(ctx->debug && error == 0)
+            kirb_event(ctx, EVENT_MISSING_VALUE, -1, NULL);
+        kirb_release(ctx, anon);
+        return 1;
+    }
+
+    *num_anon = count;
+    *anon_out = anon;
+    return 0;
+}
+
+static int compare_names(const void *a, const void *b)
+{
+    return strcmp(*(const char* const*) a, *(const char* const*) b);
+}
+
+// Node for the count names sharing their first depth characters, with its children numbered from *used
+// All of a node's children are numbered before any grandchild, so they sit side by side
+static void build_node(KirbTable *table, int node, const char **names, int count, size_t depth, int *used)
+{
+    struct KirbNode *n = &table->nodes[node];
+    int first = 0;
+
+    n->exact = -1;
+    if(count > 0 && names[0][depth] == '\0')
+    {
+        n->exact = slot_of(table, names[0]); // Sorts first, being the shortest
+        first = 1;
+    }
+    n->unique = count == 1 ? slot_of(table, names[0]) : -1;
+
+    n->num_children = 0;
+    for(int i = first; i < count; ++i)
+    {
+        if(i == first || names[i][depth] != names[i - 1][depth])
+            ++n->num_children;
+    }
+    n->children = *used;
+    *used += n->num_children;
+
+    int child = n->children;
+    for(int i = first; i < count; ++child)
+    {
+        int j = i + 1;
+        while(j < count && names[j][depth] == names[i][depth])
+            ++j;
+        table->labels[child] = (unsigned char) names[i][depth];
+        build_node(table, child, names + i, j - i, depth + 1, used);
+        i = j;
+    }
+}
+
+static int slot_of(const KirbTable *table, const char *name)
+{
+    return kirb_probe(table, name, kirb_hash(name));
+}
+
+// Slot of the long name that name spells out, or starts and no other long name does. name ends at its NUL or at
+//  an '=' the trie can't follow (or could, but leads nowhere), and *end is left there
+// Returns -1 if no long name matches and -2 if more than one starts that way
+static int trie_find(const KirbTable *table, const char *name, const char **end)
+{
+    const struct KirbNode *nodes = table->nodes;
+    const char *equals = NULL;
+    int node = 0, before_equals = 0;
+
+    for(; *name != '\0'; ++name)
+    {
+        const struct KirbNode *n = &nodes[node];
+        int next = -1;
+        for(int c = n->children; c < n->children + n->num_children; ++c)
+        {
+            if(table->labels[c] == (unsigned char) *name)
+            {
+                next = c;
+                break;
+            }
+        }
+        if(*name == '=' && equals == NULL)
+        {
+            equals = name;
+            before_equals = node;
+        }
+        if(next == -1)
+        {
+            if(equals == NULL)
+            {
+                *end = name;
+                return -1;
+            }
+            name = equals;
+            node = before_equals;
+            break;
+        }
+        node = next;
+    }
+    *end = name;
+
+    if(nodes[node].exact != -1)
+        return nodes[node].exact;
+    if(node == 0)
+        return -1; // Nothing typed isn't an abbreviation of anything
+    return nodes[node].unique != -1 ? nodes[node].unique : -2;
+}
+
+// Work out what a dashed argument means, returning 0 or the EVENT_ code of the user error it is
+// Whole option names go through the same table lookups as the other parses, so they keep every quirk
+static int resolve(const KirbTable *table, char *arg, struct resolved *r)
+{
+    r->flag = -1;
+    r->value = -1;
+    r->attached = NULL;
+    r->takes_value = 0;
+    r->short_char = -1;
+    r->slot = -1;
+
+    if(arg[1] == '\0' || arg[2] == '\0') // "-", "-X" and "--"
+    {
+        r->flag = kirb_flag(table, arg);
+        r->value = r->flag == -1 ? kirb_value(table, arg) : -1;
+        r->takes_value = kirb_takes_value(table, arg);
+        return 0;
+    }
+    if(arg[1] != '-')
+    {
+        // Only a value option has anything to attach, so a flag's character doesn't get in the way here
+        int v = table->short_value[(unsigned char) arg[1]];
+        if(v != -1)
+        {
+            r->value = v;
+            r->attached = arg + 2;
+            r->short_char = (unsigned char) arg[1];
+        }
+        return 0;
+    }
+
+    const char *end;
+    int s = trie_find(table, arg + 2, &end);
+    if(s == -2)
+        return EVENT_AMBIGUOUS_OPTION;
+    if(s == -1)
+        return 0;
+    r->slot = s;
+    if(*end == '=')
+    {
+        if(table->slots[s].value == -1)
+            return EVENT_FLAG_WITH_VALUE;
+        r->value = table->slots[s].value;
+        r->attached = (char*) end + 1;
+        return 0;
+    }
+    // Same as the whole name would be: the flag wins, but the next argument is still a value if it could be
+    r->flag = table->slots[s].flag;
+    r->value = r->flag == -1 ? table->slots[s].value : -1;
+    r->takes_value = table->slots[s].value != -1;
+    return 0;
+}
+
+// kirb_count_arg for the extended syntax, counting an argument as the option it resolved to
+static void count_arg(const KirbTable *table, char *arg, const struct resolved *r, struct tally *tally)
+{
+    if(arg[1] == '\0' || arg[2] == '\0')
+        kirb_count_arg(table, arg, tally);
+    else if(r->short_char != -1)
+        ++tally->short_count[r->short_char];
+    else if(r->slot != -1)
+        ++tally->slot_count[r->slot];
+}
+
+// kirb_walk_arg for the extended syntax
+// Returns -1 where extracting stops, with *error set to the EVENT_ code if it was a user error
+static int extended_arg(struct walk *walk, char *arg, int *error)
+{
+    const KirbTable *table = walk->table;
+    int mark;
+
+    if(arg[0] == '-')
+    {
+        struct resolved r;
+        int ret = resolve(table, arg, &r);
+        if(walk->tally != NULL)
+            count_arg(table, arg, &r, walk->tally);
+        if(walk->position == 0)
+            mark = PROGRAM;
+        else
+        {
+            if(walk->pending != -1)
+                return -1;
+            if(ret != 0)
+            {
+                if(walk->ctx->debug)
+                    kirb_event(walk->ctx, ret, walk->position, arg);
+                *error = ret;
+                return -1;
+            }
+
+            if(r.flag > -1)
+                walk->flags_out[r.flag] = 1;
+            else if(r.attached != NULL)
+                walk->values_out[r.value] = r.attached;
+            else
+                walk->pending = r.value;
+            mark = arg[1] == '-' ? OPTION_LONG : OPTION_SHORT;
+        }
+        walk->takes_value = r.takes_value;
+    }
+    else
+    {
+        if(walk->position == 0)
+            mark = PROGRAM;
+        else if(walk->takes_value)
+        {
+            if(walk->pending != -1)
+                walk->values_out[walk->pending] = arg;
+            walk->pending = -1;
+            mark = VALUE;
+        }
+        else
+            mark = ANONYMOUS;
+        walk->takes_value = 0;
+    }
+
+    ++walk->position;
+    return mark;
+}
@@ -0,0 +1,566 @@
+// kirbtypes.c
+// Values converted to numbers, sizes, durations, booleans and choices, without going through the C locale
+
+// For glibc's strtod_l and newlocale
+#if !defined(_GNU_SOURCE)
+    #define _GNU_SOURCE
+#endif
+
+#include "kirbparse.h"
+#include "kirbparse_internal.h"
+#include <locale.h>
+#include <math.h>
+#include <stdlib.h>
+#if defined(__APPLE__) || defined(__FreeBSD__)
+    #include <xlocale.h>
+#endif
+
+// strtod_l reads a double in a locale of our choosing, the C one, where the decimal point is always '.'
+#if defined(__GLIBC__) || defined(__APPLE__) || defined(__FreeBSD__)
+    #define KIRB_STRTOD_L 1
+#else
+    #define KIRB_STRTOD_L 0
+#endif
+
+// Eight digits at a time need the first character in the lowest byte of the word
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    #define KIRB_SWAR 1
+#else
+    #define KIRB_SWAR 0
+#endif
+
+// Longest run of digits a double keeps exactly, more only feed the slow path
+#define KIRB_MAX_DIGITS 19
+
+// Significant digits the slow path hands strtod, more than the 767 a double's rounding can ever depend on
+#define KIRB_SLOW_DIGITS 800
+// An exponent this far out is infinite or zero for any KIRB_SLOW_DIGITS digits
+#define KIRB_SLOW_EXPONENT 1000000
+
+// File-scope helper functions
+static int check_type(const KirbType *type);
+static const char *read_digits(const char *s, const char *end, uint64_t *value, int *overflow);
+static int convert_int(const char *s, const char *end, KirbTyped *out);
+static int convert_uint(const char *s, const char *end, KirbTyped *out);
+static int convert_double(const char *s, const char *end, KirbTyped *out);
+static int slow_double(const char *start, const char *end, const char *point, double *d);
+static int convert_bool(const char *s, const char *end, KirbTyped *out);
+static int convert_size(const char *s, const char *end, KirbTyped *out);
+static int convert_duration(const char *s, const char *end, KirbTyped *out);
+static int convert_choice(const char *s, const KirbType *type, KirbTyped *out);
+static int scale(uint64_t whole, uint64_t fraction, int fraction_digits, uint64_t unit, uint64_t *result);
+#if KIRB_SWAR
+static int eight_digits(uint64_t chunk);
+static uint64_t eight_value(uint64_t chunk);
+#endif
+
+#if KIRB_STRTOD_L
+static locale_t c_locale;
+
+// Made once before main, so converting threads only ever read it
+__attribute__((constructor)) static void make_c_locale(void)
+{
+    c_locale = newlocale(LC_ALL_MASK, "C", (locale_t) 0);
+}
+#endif
+
+static const uint64_t powers[] = {
+    1u, 10u, 100u, 1000u, 10000u, 100000u, 1000000u, 10000000u, 100000000u, 1000000000u
+};
+
+// Every power of ten a double holds exactly
+static const double exact_powers[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+int Kirb_parse_typed(int argc, char **argv, const KirbContext *ctx, const KirbType *types,
+                     int *flags_out, KirbTyped *typed_out, int *num_anon, char ***anon_out)
+{
+    if(kirb_check_context(ctx) == -1 || (ctx->table.num_value_opts > 0 && (types == NULL || typed_out == NULL)))
+        return -1;
+    for(int v = 0; v < ctx->table.num_value_opts; ++v)
+    {
+        if(check_type(&types[v]) == -1)
+            return -1;
+    }
+
+    char *values[ctx->table.num_value_opts + 1];
+    int ret = Kirb_parse_all_ctx(argc, argv, ctx, flags_out, values, num_anon, anon_out);
+    if(ret != 0 && ret != 2)
+    {
+        for(int v = 0; v < ctx->table.num_value_opts; ++v)
+            Kirb_convert(NULL, &types[v], &typed_out[v]);
+        return ret;
+    }
+
+    // Every value is converted, so one bad value doesn't hide the next
+    int bad = 0;
+    for(int v = 0; v < ctx->table.num_value_opts; ++v)
+    {
+        if(Kirb_convert(values[v], &types[v], &typed_out[v]) > KIRB_VALUE_ABSENT)
+        {
+            if(ctx->debug)
+                kirb_event(ctx, EVENT_BAD_VALUE, -1, values[v]);
+            bad = 1;
+        }
+    }
+    if(bad)
+    {
+        kirb_release(ctx, *anon_out);
+        *anon_out = NULL;
+        return 1;
+    }
+    return ret;
+}
+
+int Kirb_convert(const char *text, const KirbType *type, KirbTyped *out)
+{
+    if(type == NULL || out == NULL || check_type(type) == -1)
+        return -1;
+
+    out->as.u = 0;
+    out->text = text;
+    if(text == NULL)
+        return out->status = KIRB_VALUE_ABSENT;
+    if(type->kind == KIRB_STRING)
+    {
+        out->as.s = text;
+        return out->status = KIRB_VALUE_OK;
+    }
+    if(text[0] == '\0')
+        return out->status = KIRB_VALUE_EMPTY;
+
+    const char *end = text + strlen(text);
+    switch(type->kind)
+    {
+        case KIRB_INT64: return out->status = convert_int(text, end, out);
+        case KIRB_UINT64: return out->status = convert_uint(text, end, out);
+        case KIRB_DOUBLE: return out->status = convert_double(text, end, out);
+        case KIRB_BOOL: return out->status = convert_bool(text, end, out);
+        case KIRB_SIZE: return out->status = convert_size(text, end, out);
+        case KIRB_DURATION: return out->status = convert_duration(text, end, out);
+        default: return out->status = convert_choice(text, type, out);
+    }
+}
+
+static int check_type(const KirbType *type)
+{
+    if(type->kind < KIRB_STRING || type->kind > KIRB_CHOICE)
+        return -1;
+    if(type->kind == KIRB_CHOICE && (type->num_choices < 1 || type->choices == NULL))
+        return -1;
+    return 0;
+}
+
+// Digits from s until the first non-digit or end, added onto *value. *overflow is set once the total passes
+//  UINT64_MAX, the digits are still read so the caller knows where they stop
+static const char *read_digits(const char *s, const char *end, uint64_t *value, int *overflow)
+{
+    uint64_t v = *value;
+#if KIRB_SWAR
+    while(end - s >= 8)
+    {
+        uint64_t chunk;
+        memcpy(&chunk, s, 8);
+        if(!eight_digits(chunk))
+            break;
+        uint64_t eight = eight_value(chunk);
+        if(v > (UINT64_MAX - eight) / 100000000u)
+            *overflow = 1;
+        v = v * 100000000u + eight;
+        s += 8;
+    }
+#endif
+    for(; s < end && (unsigned char) (*s - '0') < 10; ++s)
+    {
+        unsigned int d = (unsigned int) (*s - '0');
+        if(v > (UINT64_MAX - d) / 10)
+            *overflow = 1;
+        v = v * 10 + d;
+    }
+    *value = v;
+    return s;
+}
+
+#if KIRB_SWAR
+// Whether all eight bytes are '0' to '9': the high nibbles must all be 3, and stay 3 with 6 added to the low ones
+static int eight_digits(uint64_t chunk)
+{
+    return ((chunk & 0xF0F0F0F0F0F0F0F0u) | (((chunk + 0x0606060606060606u) & 0xF0F0F0F0F0F0F0F0u) >> 4)) ==
+           0x3333333333333333u;
+}
+
+// The eight digits as a number, merging neighbouring pairs, then fours, then the two halves
+static uint64_t eight_value(uint64_t chunk)
+{
+    chunk = ((chunk & 0x0F0F0F0F0F0F0F0Fu) * 2561) >> 8;
+    chunk = ((chunk & 0x00FF00FF00FF00FFu) * 6553601) >> 16;
+    return ((chunk & 0x0000FFFF0000FFFFu) * 42949672960001u) >> 32;
+}
+#endif
+
+static int convert_int(const char *s, const char *end, KirbTyped *out)
+{
+    int negative = *s == '-';
+    if(*s == '-' || *s == '+')
+        ++s;
+    uint64_t magnitude = 0;
+    int overflow = 0;
+    const char *stop = read_digits(s, end, &magnitude, &overflow);
+    if(stop == s || stop != end)
+        return KIRB_VALUE_MALFORMED;
+    if(overflow || magnitude > (uint64_t) INT64_MAX + negative)
+        return KIRB_VALUE_RANGE;
+    out->as.i = negative ? (int64_t) (0 - magnitude) : (int64_t) magnitude;
+    return KIRB_VALUE_OK;
+}
+
+static int convert_uint(const char *s, const char *end, KirbTyped *out)
+{
+    // A negative number is still a number, just not one that fits
+    int negative = *s == '-';
+    if(*s == '-' || *s == '+')
+        ++s;
+    uint64_t value = 0;
+    int overflow = 0;
+    const char *stop = read_digits(s, end, &value, &overflow);
+    if(stop == s || stop != end)
+        return KIRB_VALUE_MALFORMED;
+    if(overflow || (negative && value != 0))
+        return KIRB_VALUE_RANGE;
+    out->as.u = value;
+    return KIRB_VALUE_OK;
+}
+
+// Decimal numbers with an optional fraction and exponent, always with a '.' whatever the locale says
+// Digits up to 2^53 scaled by a power of ten up to 22 are exact with one multiply or divide, the rest go through strtod
+static int convert_double(const char *s, const char *end, KirbTyped *out)
+{
+    const char *start = s;
+    int negative = *s == '-';
+    if(*s == '-' || *s == '+')
+        ++s;
+
+    uint64_t mantissa = 0;
+    int digits = 0, exponent = 0;
+    for(; s < end && (unsigned char) (*s - '0') < 10; ++s)
+    {
+        if(digits < KIRB_MAX_DIGITS)
+        {
+            mantissa = mantissa * 10 + (uint64_t) (*s - '0');
+            digits += mantissa != 0;
+        }
+        else
+            ++exponent, ++digits;
+    }
+    int any = s > start + (start[0] == '-' || start[0] == '+');
+    const char *point = NULL;
+    if(s < end && *s == '.')
+    {
+        point = s++;
+        for(; s < end && (unsigned char) (*s - '0') < 10; ++s)
+        {
+            if(digits < KIRB_MAX_DIGITS)
+            {
+                mantissa = mantissa * 10 + (uint64_t) (*s - '0');
+                digits += mantissa != 0;
+                --exponent;
+            }
+            else
+                ++digits;
+        }
+        any |= s > point + 1;
+    }
+    if(!any)
+        return KIRB_VALUE_MALFORMED;
+    if(s < end && (*s == 'e' || *s == 'E'))
+    {
+        ++s;
+        int exponent_negative = s < end && *s == '-';
+        if(s < end && (*s == '-' || *s == '+'))
+            ++s;
+        uint64_t given = 0;
+        int overflow = 0;
+        const char *stop = read_digits(s, end, &given, &overflow);
+        if(stop == s)
+            return KIRB_VALUE_MALFORMED;
+        s = stop;
+        if(overflow || given > 100000)
+            given = 100000; // Far past where every double is infinite or zero
+        exponent += exponent_negative ? -(int) given : (int) given;
+    }
+    if(s != end)
+        return KIRB_VALUE_MALFORMED;
+
+    double d;
+    if(digits <= KIRB_MAX_DIGITS && mantissa <= ((uint64_t) 1 << 53) && exponent >= -22 && exponent <= 22)
+    {
+        d = (double) mantissa;
+        d = exponent < 0 ? d / exact_powers[-exponent] : d * exact_powers[exponent];
+    }
+    else
+    {
+        int status = slow_double(start, end, point, &d);
+        if(status != KIRB_VALUE_OK)
+            return status;
+        negative = 0; // strtod read the sign too
+    }
+    if(isinf(d))
+        return KIRB_VALUE_RANGE;
+    out->as.d = negative ? -d : d;
+    return KIRB_VALUE_OK;
+}
+
+// strtod on the whole of a number convert_double has already checked, which ends at the NUL at end
+static int slow_double(const char *start, const char *end, const char *point, double *d)
+{
+#if KIRB_STRTOD_L
+    if(c_locale != (locale_t) 0)
+    {
+        *d = strtod_l(start, NULL, c_locale);
+        return KIRB_VALUE_OK;
+    }
+#endif
+
+    // Otherwise strtod wants the current locale's decimal point, so if that isn't '.' the number is rewritten
+    //  without one: its significant digits as a whole number, then an exponent moved to make up for the point
+    const char *decimal = localeconv()->decimal_point;
+    if(point == NULL || strcmp(decimal, ".") == 0)
+    {
+        *d = strtod(start, NULL);
+        return KIRB_VALUE_OK;
+    }
+    char text[KIRB_SLOW_DIGITS + 16];
+    size_t length = 0;
+    long long exponent = 0;
+    int sticky = 0;
+    const char *s = start;
+    if(*s == '-' || *s == '+')
+        text[length++] = *s++;
+    size_t first = length;
+    for(; s < end && *s != 'e' && *s != 'E'; ++s)
+    {
+        if(*s == '.')
+            continue;
+        if(s > point)
+            --exponent;
+        if(length == first && *s == '0')
+            continue; // Leading zeros carry nothing
+        if(length - first < KIRB_SLOW_DIGITS)
+            text[length++] = *s;
+        else
+        {
+            // Past the digits that can still decide the rounding, all that matters is whether any aren't 0
+            ++exponent;
+            sticky |= *s != '0';
+        }
+    }
+    if(sticky)
+    {
+        text[length++] = '1';
+        --exponent;
+    }
+    if(length == first)
+        text[length++] = '0';
+    if(s < end)
+    {
+        int exponent_negative = s[1] == '-';
+        uint64_t given = 0;
+        int overflow = 0;
+        read_digits(s + 1 + (s[1] == '-' || s[1] == '+'), end, &given, &overflow);
+        if(overflow || given > KIRB_SLOW_EXPONENT)
+            given = KIRB_SLOW_EXPONENT;
+        exponent += exponent_negative ? -(long long) given : (long long) given;
+    }
+    if(exponent > KIRB_SLOW_EXPONENT || exponent < -KIRB_SLOW_EXPONENT)
+        exponent = exponent > 0 ? KIRB_SLOW_EXPONENT : -KIRB_SLOW_EXPONENT; // Infinite or zero either way
+
+    // Exponent digits, written backwards then reversed
+    text[length++] = 'e';
+    if(exponent < 0)
+        text[length++] = '-';
+    unsigned long long magnitude = (unsigned long long) (exponent < 0 ? -exponent : exponent);
+    size_t digits_start = length;
+    do
+    {
+        text[length++] = (char) ('0' + magnitude % 10);
+        magnitude /= 10;
+    } while(magnitude != 0);
+    for(size_t i = digits_start, j = length - 1; i < j; ++i, --j)
+    {
+        char swap = text[i];
+        text[i] = text[j];
+        text[j] = swap;
+    }
+    text[length] = '\0';
+    *d = strtod(text, NULL);
+    return KIRB_VALUE_OK;
+}
+
+static int convert_bool(const char *s, const char *end, KirbTyped *out)
+{
+    static const struct
+    {
+        const char *text;
+        int value;
+    } words[] = {
+        { "1", 1 }, { "0", 0 }, { "true", 1 }, { "false", 0 }, { "yes", 1 }, { "no", 0 }, { "on", 1 }, { "off", 0 }
+    };
+    char lower[6];
+    size_t length = (size_t) (end - s);
+    if(length >= sizeof(lower))
+        return KIRB_VALUE_MALFORMED;
+    for(size_t i = 0; i <= length; ++i)
+        lower[i] = (char) (s[i] >= 'A' && s[i] <= 'Z' ? s[i] + ('a' - 'A') : s[i]);
+    for(size_t w = 0; w < sizeof(words) / sizeof(words[0]); ++w)
+    {
+        if(strcmp(lower, words[w].text) == 0)
+        {
+            out->as.b = words[w].value;
+            return KIRB_VALUE_OK;
+        }
+    }
+    return KIRB_VALUE_MALFORMED;
+}
+
+// A count of bytes with an optional fraction and a binary unit: 512, 64K, 1.5GiB, 10mb
+static int convert_size(const char *s, const char *end, KirbTyped *out)
+{
+    uint64_t whole = 0, fraction = 0;
+    int overflow = 0, fraction_digits = 0;
+    const char *stop = read_digits(s, end, &whole, &overflow);
+    if(stop == s)
+        return KIRB_VALUE_MALFORMED;
+    s = stop;
+    if(s < end && *s == '.')
+    {
+        const char *first = ++s;
+        for(; s < end && (unsigned char) (*s - '0') < 10; ++s)
+        {
+            if(fraction_digits < 9)
+                fraction = fraction * 10 + (uint64_t) (*s - '0'), ++fraction_digits; // Past a billionth is noise
+        }
+        if(s == first)
+            return KIRB_VALUE_MALFORMED;
+    }
+
+    int shift = 0;
+    if(s < end)
+    {
+        const char *units = "KMGTPE";
+        char upper = (char) (*s >= 'a' && *s <= 'z' ? *s - ('a' - 'A') : *s);
+        const char *unit = upper != '\0' ? strchr(units, upper) : NULL;
+        if(unit != NULL)
+        {
+            shift = 10 * (int) (unit - units + 1);
+            ++s;
+            if(s < end && *s == 'i')
+                ++s;
+        }
+        if(s < end && (*s == 'B' || *s == 'b'))
+            ++s;
+        if(s != end)
+            return KIRB_VALUE_UNIT;
+    }
+    if(overflow || scale(whole, fraction, fraction_digits, (uint64_t) 1 << shift, &out->as.u) == -1)
+        return KIRB_VALUE_RANGE;
+    return KIRB_VALUE_OK;
+}
+
+// One or more numbers with units, added up in nanoseconds: 250ms, 1.5s, 1h30m, -2m
+static int convert_duration(const char *s, const char *end, KirbTyped *out)
+{
+    static const struct
+    {
+        const char *name;
+        uint64_t ns;
+    } units[] = {
+        { "ns", 1u }, { "us", 1000u }, { "ms", 1000000u }, { "s", 1000000000u }, { "m", 60000000000u },
+        { "h", 3600000000000u }, { "d", 86400000000000u }
+    };
+    int negative = *s == '-';
+    if(*s == '-' || *s == '+')
+        ++s;
+    if(s == end)
+        return KIRB_VALUE_MALFORMED;
+
+    uint64_t total = 0;
+    int range = 0;
+    while(s < end)
+    {
+        uint64_t whole = 0, fraction = 0;
+        int overflow = 0, fraction_digits = 0;
+        const char *stop = read_digits(s, end, &whole, &overflow);
+        int any = stop != s;
+        s = stop;
+        if(s < end && *s == '.')
+        {
+            for(++s; s < end && (unsigned char) (*s - '0') < 10; ++s, any = 1)
+            {
+                if(fraction_digits < 9)
+                    fraction = fraction * 10 + (uint64_t) (*s - '0'), ++fraction_digits;
+            }
+        }
+        if(!any)
+            return KIRB_VALUE_MALFORMED;
+
+        // The unit runs up to the next number, so "ms" can't be taken for minutes
+        size_t length = 0;
+        while(s + length < end && (unsigned char) (s[length] - '0') >= 10 && s[length] != '.')
+            ++length;
+        int u = -1;
+        for(int i = 0; i < (int) (sizeof(units) / sizeof(units[0])); ++i)
+        {
+            if(strlen(units[i].name) == length && memcmp(s, units[i].name, length) == 0)
+                u = i;
+        }
+        if(u == -1)
+            return KIRB_VALUE_UNIT;
+        s += length;
+
+        uint64_t part;
+        if(overflow || scale(whole, fraction, fraction_digits, units[u].ns, &part) == -1 || part > UINT64_MAX - total)
+            range = 1; // Keep going, a bad unit further on is the better thing to report
+        else
+            total += part;
+    }
+    if(range || total > (uint64_t) INT64_MAX + negative)
+        return KIRB_VALUE_RANGE;
+    out->as.i = negative ? (int64_t) (0 - total) : (int64_t) total;
+    return KIRB_VALUE_OK;
+}
+
+static int convert_choice(const char *s, const KirbType *type, KirbTyped *out)
+{
+    for(int c = 0; c < type->num_choices; ++c)
+    {
+        if(type->choices[c] != NULL && strcmp(s, type->choices[c]) == 0)
+        {
+            out->as.i = c;
+            return KIRB_VALUE_OK;
+        }
+    }
+    return KIRB_VALUE_CHOICE;
+}
+
+// whole.fraction (fraction_digits long) times unit, rounded down, -1 if it doesn't fit in 64 bits
+static int scale(uint64_t whole, uint64_t fraction, int fraction_digits, uint64_t unit, uint64_t *result)
+{
+    if(unit != 0 && whole > UINT64_MAX / unit)
+        return -1;
+    uint64_t value = whole * unit;
+    if(fraction_digits > 0)
+    {
+        // fraction < 10^9, so split the unit to keep fraction * unit within 64 bits
+        uint64_t high = unit / powers[fraction_digits], low = unit % powers[fraction_digits];
+        if(fraction != 0 && high > UINT64_MAX / fraction)
+            return -1;
+        uint64_t part = fraction * high + fraction * low / powers[fraction_digits];
+        if(part > UINT64_MAX - value)
+            return -1;
+        value += part;
+    }
+    *result = value;
+    return 0;
+}
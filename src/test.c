@@ -1,14 +1,101 @@
 // Basic test file for all KirbParse functionality
 
 #include "kirbparse.h"
+#include "test_rules.h"
+#include <locale.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#if !defined(_WIN32)
+    #include <unistd.h>
+#endif
 
 // MSVC compiler toolchains don't like a lot of insecure stdlib functions like fopen()
 #if defined _MSC_VER
     #define _CRT_SECURE_NO_WARNINGS
 #endif // defined _MSC_VER
 
+#if defined(KIRB_WRAP_MALLOC)
+// Linked with --wrap (see CMakeLists.txt), so every malloc, calloc and realloc the library makes comes through here
+//  and is counted while count_real is set, whether or not it went through a context's alloc hook
+// Every malloc fails while fail_real is set
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+static int count_real = 0, real_allocations = 0, fail_real = 0;
+
+void *__wrap_malloc(size_t size)
+{
+    real_allocations += count_real;
+    return fail_real ? NULL : __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+    real_allocations += count_real;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    real_allocations += count_real;
+    return __real_realloc(ptr, size);
+}
+#endif
+
+// Allocator that counts its calls, to check which parses allocate
+static void *count_alloc(size_t size, void *user)
+{
+    ++*(int*) user;
+    return malloc(size);
+}
+
+static void count_release(void *ptr, void *user)
+{
+    (void) user;
+    free(ptr);
+}
+
+// Write a response file fixture, 0 on success
+static int write_fixture(const char *path, const char *text, size_t size)
+{
+    FILE *fixture = fopen(path, "wb");
+    if(fixture == NULL)
+        return -1;
+    int ok = fwrite(text, 1, size, fixture) == size;
+    return fclose(fixture) == 0 && ok ? 0 : -1;
+}
+
+// Expand argv and check it became exactly the expected arguments, 0 if it did
+static int check_expanded(int argc, char **argv, int num_expected, const char *const *expected, const char *what)
+{
+    KirbArgs expanded;
+    if(Kirb_expand(argc, argv, NULL, &expanded) != 0)
+    {
+        printf("FAILED: expanding %s\n", what);
+        return 1;
+    }
+    int agree = expanded.argc == num_expected;
+    for(int i = 0; agree && i < num_expected; ++i)
+        agree = strcmp(expanded.argv[i], expected[i]) == 0 && expanded.lengths[i] == strlen(expected[i]);
+    if(!agree)
+    {
+        printf("FAILED: expanding %s gave", what);
+        for(int i = 0; i < expanded.argc; ++i)
+            printf(" [%s]", expanded.argv[i]);
+        printf("\n");
+    }
+    Kirb_free_args(NULL, &expanded);
+    return !agree;
+}
+
+// Anonymous value callback for streams, counting what it's given
+static void stream_anon(char *anon, int position, void *user)
+{
+    printf("streamed anon value %s found at %d\n", anon, position);
+    ++*(int*) user;
+}
+
 int main(int argc, char* argv[])
 {
     FILE *file = fopen("debug_log.txt", "w"); // Yes it's insecure but not everyone uses C11 and this is a publicly hosted library
@@ -30,7 +117,8 @@ int main(int argc, char* argv[])
     long_values[0] = "output\0";
     int flags_results[2];
     char *values_results[1];
-    char ***anon_results = malloc(sizeof(char**)); // No way to know how many anons the user will input, dynamic
+    char **anon_results = NULL; // No way to know how many anons the user will input, allocated by the library
+    int failed = 0;
 
     // Test Prep phase
     {
@@ -52,11 +140,217 @@ int main(int argc, char* argv[])
 
     // Test Mark phase
     {
-        enum Mark marks[7];
+        enum Mark *marks = malloc(argc * sizeof(enum Mark));
+        uint8_t *compact_marks = malloc(argc);
         Kirb_mark(argc, argv, 1, values, long_values, marks);
+        Kirb_mark_compact(argc, argv, 1, values, long_values, compact_marks);
         for (int i = 0; i < argc; ++i)
         {
             printf("marked argument %d: %d\n", i, (int) marks[i]);
+            if(compact_marks[i] != marks[i])
+            {
+                printf("FAILED: compact mark %d for argument %d\n", compact_marks[i], i);
+                failed = 1;
+            }
+        }
+        free(marks);
+        free(compact_marks);
+    }
+
+    printf("long names looked up with the %s kernel\n", Kirb_simd_kernel());
+
+    // Test a command line too long to mark on the stack
+    {
+        int big_argc = 200000, num_anon;
+        char **big_argv = malloc(big_argc * sizeof(char*));
+        char **anon = NULL;
+        big_argv[0] = argv[0];
+        for(int i = 1; i < big_argc; ++i)
+            big_argv[i] = i % 2 ? "-o" : "hello.c";
+        big_argv[big_argc - 1] = "world.c";
+        kirbparse_debug = 0;
+        if(Kirb_parse_all(big_argc, big_argv, 2, flags, long_flags, 0, 1, 1, values, long_values,
+                          flags_results, values_results, &num_anon, &anon) == 0)
+        {
+            printf("long command line: %d anonymous values, last value %s\n", num_anon, values_results[0]);
+            Kirb_free_anon(NULL, anon);
+        }
+#if defined(KIRB_WRAP_MALLOC)
+        // Running out of memory for the marks is an error of its own, not a parse of unmarked arguments
+        // The messages go to a file with its buffer set up front, so printing them needs no malloc
+        static char log_buffer[BUFSIZ];
+        FILE *log = tmpfile();
+        if(log != NULL && setvbuf(log, log_buffer, _IOFBF, sizeof(log_buffer)) == 0)
+        {
+            FILE *info = kirbparse_info, *err = kirbparse_err;
+            kirbparse_info = log;
+            kirbparse_err = log;
+            kirbparse_debug = 1;
+            fail_real = 1;
+            int oom_ret = Kirb_parse_all(big_argc, big_argv, 2, flags, long_flags, 0, 1, 1, values, long_values,
+                                         flags_results, values_results, &num_anon, &anon);
+            fail_real = 0;
+            kirbparse_info = info;
+            kirbparse_err = err;
+
+            char text[1024];
+            long length = ftell(log);
+            rewind(log);
+            text[fread(text, 1, length > 0 && length < (long) sizeof(text) ? (size_t) length : 0, log)] = '\0';
+            if(oom_ret != -1 || strstr(text, "Out of memory") == NULL)
+            {
+                printf("FAILED: parse without memory for its marks returned %d without saying so\n", oom_ret);
+                failed = 1;
+            }
+        }
+        if(log != NULL)
+            fclose(log);
+#endif
+        kirbparse_debug = 1;
+
+        // Long enough to be marked on several threads, which should change nothing
+        KirbContext ctx;
+        if(Kirb_context_init(&ctx, kirbparse_info, kirbparse_err, 2, flags, long_flags, 1, values, long_values, 0, 1)
+           == 0)
+        {
+            enum Mark *serial = malloc(big_argc * sizeof(enum Mark));
+            enum Mark *parallel = malloc(big_argc * sizeof(enum Mark));
+            if(serial != NULL && parallel != NULL &&
+               (Kirb_mark_ctx(big_argc, big_argv, &ctx, serial) !=
+                    Kirb_mark_parallel(big_argc, big_argv, &ctx, parallel, 4) ||
+                memcmp(serial, parallel, big_argc * sizeof(enum Mark)) != 0))
+            {
+                printf("FAILED: parallel marks differ from Kirb_mark_ctx\n");
+                failed = 1;
+            }
+            free(serial);
+            free(parallel);
+            Kirb_context_free(&ctx);
+        }
+        free(big_argv);
+    }
+
+    // Test response files, run with @file to see one expanded
+    {
+        KirbArgs expanded;
+        if(Kirb_expand(argc, argv, NULL, &expanded) == 0)
+        {
+            for(int i = 1; i < expanded.argc; ++i)
+                printf("expanded argument %d: %s (%d bytes)\n", i, expanded.argv[i], (int) expanded.lengths[i]);
+            Kirb_free_args(NULL, &expanded);
+        }
+
+        // Quotes and escapes, with a nested file in the middle and a missing one at the end
+        const char quoted[] = "plain 'single quoted'\t\"double \\\"quoted\\\"\"\n"
+                              "back\\ slash 'it''s' \"\" end\\\\ @kirb_inner.rsp";
+        const char inner[] = "-v --output 'x y'\n";
+        char *quoted_argv[] = { argv[0], "a", "@kirb_quoted.rsp", "@kirb_missing.rsp", "@" };
+        const char *quoted_expected[] = {
+            argv[0], "a", "plain", "single quoted", "double \"quoted\"", "back slash", "its", "", "end\\", "-v",
+            "--output", "x y", "@kirb_missing.rsp", "@"
+        };
+        if(write_fixture("kirb_quoted.rsp", quoted, sizeof(quoted) - 1) != 0 ||
+           write_fixture("kirb_inner.rsp", inner, sizeof(inner) - 1) != 0)
+        {
+            printf("FAILED: writing response file fixtures\n");
+            failed = 1;
+        }
+        else
+            failed |= check_expanded(5, quoted_argv, 14, quoted_expected, "quotes and a nested file");
+
+        // A file that fills its page exactly, so the last argument's NUL lands past the end of the file
+        size_t page = 4096;
+#if !defined(_WIN32)
+        page = (size_t) sysconf(_SC_PAGESIZE);
+#endif
+        char *full = malloc(page);
+        if(full != NULL)
+        {
+            for(size_t b = 0; b + 4 < page; b += 4)
+                memcpy(full + b, "abc ", 4);
+            memcpy(full + page - 4, "wxyz", 4);
+            char *full_argv[] = { argv[0], "@kirb_full.rsp" };
+            KirbArgs expanded;
+            if(write_fixture("kirb_full.rsp", full, page) != 0 || Kirb_expand(2, full_argv, NULL, &expanded) != 0)
+            {
+                printf("FAILED: expanding a response file that fills its page\n");
+                failed = 1;
+            }
+            else
+            {
+                if(expanded.argc != 1 + (int) (page / 4) || strcmp(expanded.argv[1], "abc") != 0 ||
+                   strcmp(expanded.argv[expanded.argc - 1], "wxyz") != 0)
+                {
+                    printf("FAILED: a response file that fills its page gave %d arguments\n", expanded.argc);
+                    failed = 1;
+                }
+                Kirb_free_args(NULL, &expanded);
+            }
+            free(full);
+            remove("kirb_full.rsp");
+        }
+
+        // Files naming the next file, one more deep than expanding goes, so the last @file is left as it is
+        char names[KIRB_RESPONSE_DEPTH + 1][24], words[KIRB_RESPONSE_DEPTH][8];
+        const char *depth_expected[KIRB_RESPONSE_DEPTH + 2];
+        depth_expected[0] = argv[0];
+        int written = 1;
+        for(int d = 0; d <= KIRB_RESPONSE_DEPTH; ++d)
+            sprintf(names[d], "@kirb_depth_%d.rsp", d);
+        for(int d = 0; d < KIRB_RESPONSE_DEPTH; ++d)
+        {
+            char text[40];
+            sprintf(words[d], "d%d", d);
+            sprintf(text, "%s %s", words[d], names[d + 1]);
+            written &= write_fixture(names[d] + 1, text, strlen(text)) == 0;
+            depth_expected[d + 1] = words[d];
+        }
+        depth_expected[KIRB_RESPONSE_DEPTH + 1] = names[KIRB_RESPONSE_DEPTH];
+        written &= write_fixture(names[KIRB_RESPONSE_DEPTH] + 1, "too deep", 8) == 0;
+        char *depth_argv[] = { argv[0], names[0] };
+        if(!written)
+        {
+            printf("FAILED: writing response file fixtures\n");
+            failed = 1;
+        }
+        else
+            failed |= check_expanded(2, depth_argv, KIRB_RESPONSE_DEPTH + 2, depth_expected, "nested files");
+        for(int d = 0; d <= KIRB_RESPONSE_DEPTH; ++d)
+            remove(names[d] + 1);
+        remove("kirb_quoted.rsp");
+        remove("kirb_inner.rsp");
+
+        // A file naming itself isn't expanded inside itself
+        const char self[] = "x @kirb_self.rsp @./kirb_self.rsp";
+        char *self_argv[] = { argv[0], "@kirb_self.rsp" };
+        const char *self_expected[] = { argv[0], "x", "@kirb_self.rsp", "@./kirb_self.rsp" };
+        if(write_fixture("kirb_self.rsp", self, sizeof(self) - 1) != 0)
+        {
+            printf("FAILED: writing response file fixtures\n");
+            failed = 1;
+        }
+        else
+            failed |= check_expanded(2, self_argv, 4, self_expected, "a file naming itself");
+        remove("kirb_self.rsp");
+
+        // One more file than the limit, all of them side by side
+        size_t many_size = (KIRB_RESPONSE_FILES + 1) * 15;
+        char *many = malloc(many_size);
+        if(many != NULL)
+        {
+            for(size_t b = 0; b < many_size; b += 15)
+                memcpy(many + b, "@kirb_leaf.rsp ", 15);
+            char *many_argv[] = { argv[0], "@kirb_many.rsp" };
+            KirbArgs expanded;
+            if(write_fixture("kirb_many.rsp", many, many_size) != 0 || write_fixture("kirb_leaf.rsp", "y", 1) != 0 ||
+               Kirb_expand(2, many_argv, NULL, &expanded) != -1)
+            {
+                printf("FAILED: expanded more than KIRB_RESPONSE_FILES response files\n");
+                failed = 1;
+            }
+            free(many);
+            remove("kirb_many.rsp");
+            remove("kirb_leaf.rsp");
         }
     }
 
@@ -66,7 +360,7 @@ int main(int argc, char* argv[])
         int res = Kirb_parse_all(argc, argv,
                                  2, flags, long_flags,
                                  0, 0, 1, values, long_values,
-                                 flags_results, values_results, &num_anon, anon_results);
+                                 flags_results, values_results, &num_anon, &anon_results);
         if(res == 0)
         {
             for(int i = 0; i < 2; ++i)
@@ -74,11 +368,435 @@ int main(int argc, char* argv[])
             for(int i = 0; i < 1; ++i)
                 printf("resulting value for %c: %s\n", values[i], values_results[i]);
             for(int i = 0; i < num_anon; ++i)
-                printf("anon value %s found\n", *anon_results[i]);
+                printf("anon value %s found\n", anon_results[i]);
+            Kirb_free_anon(NULL, anon_results);
+        }
+    }
+
+    // Test compiled rules
+    {
+        KirbTable table;
+        int num_anon;
+        char **anon = NULL;
+        if(Kirb_compile(&table, 2, flags, long_flags, 1, values, long_values, 0) == 0)
+        {
+            int res = Kirb_parse_table(argc, argv, &table, 0, flags_results, values_results, &num_anon, &anon);
+            if(res == 0)
+            {
+                for(int i = 0; i < 2; ++i)
+                    printf("compiled flag bool for %c: %d\n", flags[i], flags_results[i]);
+                for(int i = 0; i < 1; ++i)
+                    printf("compiled value for %c: %s\n", values[i], values_results[i]);
+                for(int i = 0; i < num_anon; ++i)
+                    printf("compiled anon value %s found\n", anon[i]);
+                Kirb_free_anon(NULL, anon);
+            }
+
+            anon = NULL;
+            res = Kirb_parse_fused(argc, argv, &table, 0, flags_results, values_results, &num_anon, &anon);
+            if(res == 0)
+            {
+                for(int i = 0; i < 2; ++i)
+                    printf("fused flag bool for %c: %d\n", flags[i], flags_results[i]);
+                for(int i = 0; i < 1; ++i)
+                    printf("fused value for %c: %s\n", values[i], values_results[i]);
+                for(int i = 0; i < num_anon; ++i)
+                    printf("fused anon value %s found\n", anon[i]);
+                Kirb_free_anon(NULL, anon);
+            }
+            Kirb_free_table(&table);
+        }
+    }
+
+    // Test contexts
+    {
+        KirbContext ctx;
+        int num_anon;
+        char **anon = NULL;
+        if(Kirb_context_init(&ctx, file, stderr, 2, flags, long_flags, 1, values, long_values, 0, 0) == 0)
+        {
+            ctx.debug = 1;
+            int res = Kirb_parse_all_ctx(argc, argv, &ctx, flags_results, values_results, &num_anon, &anon);
+            if(res == 0)
+            {
+                for(int i = 0; i < 2; ++i)
+                    printf("context flag bool for %c: %d\n", flags[i], flags_results[i]);
+                for(int i = 0; i < 1; ++i)
+                    printf("context value for %c: %s\n", values[i], values_results[i]);
+                for(int i = 0; i < num_anon; ++i)
+                    printf("context anon value %s found\n", anon[i]);
+                Kirb_free_anon(&ctx, anon);
+            }
+
+            // Test lazy parsing, which should agree with the context parse above
+            KirbLazy *lazy = Kirb_open(argc, argv, &ctx);
+            if(lazy != NULL)
+            {
+                int present;
+                char *value, *lazy_anon;
+                if(Kirb_get_flag(lazy, 0, &present) == 0)
+                    printf("lazy flag bool for %c: %d\n", flags[0], present);
+                if(Kirb_get_value(lazy, 0, &value) == 0)
+                    printf("lazy value for %c: %s\n", values[0], value);
+                while(Kirb_next_anon(lazy, &lazy_anon) == 0 && lazy_anon != NULL)
+                    printf("lazy anon value %s found\n", lazy_anon);
+                if(Kirb_finish(lazy) != (res != 0))
+                {
+                    printf("FAILED: lazy parse finished with %d, context parse returned %d\n", Kirb_finish(lazy), res);
+                    failed = 1;
+                }
+                Kirb_close(lazy);
+            }
+
+            // Test the extended syntax on a fixed command line, an abbreviation and an attached value
+            char *ext_argv[] = { argv[0], "--verb", "--out=main.c", "-ofile.c", "notes.txt" };
+            int ext_flags[2], ext_num_anon;
+            char *ext_values[1], **ext_anon = NULL;
+            KirbContext ext_ctx = ctx;
+            ext_ctx.allow_crossover = 1; // --out= and -o both set the value, the last one wins
+            if(Kirb_parse_extended(5, ext_argv, &ext_ctx, ext_flags, ext_values, &ext_num_anon, &ext_anon) == 0)
+            {
+                printf("extended flag bool for %c: %d, value for %c: %s, %d anon\n", flags[0], ext_flags[0],
+                       values[0], ext_values[0], ext_num_anon);
+                if(!ext_flags[0] || ext_values[0] == NULL || strcmp(ext_values[0], "file.c") != 0 ||
+                   ext_num_anon != 1 || strcmp(ext_anon[0], "notes.txt") != 0)
+                {
+                    printf("FAILED: extended parse missed the abbreviation, the last value or the anonymous value\n");
+                    failed = 1;
+                }
+                Kirb_free_anon(&ctx, ext_anon);
+            }
+            else
+            {
+                printf("FAILED: extended parse of a fixed command line\n");
+                failed = 1;
+            }
+
+            // Test the flags as a bitset, which should agree with the context parse
+            uint64_t flag_bits[KIRB_FLAG_WORDS(2)], both[KIRB_FLAG_WORDS(2)];
+            char *bits_values[1], **bits_anon = NULL;
+            int bits_num_anon, both_flags[2] = { 0, 1 }, pairs[2] = { 0, 1 }, bad_pairs[2] = { 0, 2 };
+            if(Kirb_parse_bits(argc, argv, &ctx, flag_bits, bits_values, &bits_num_anon, &bits_anon) == 0)
+            {
+                Kirb_flag_mask(both, 2, both_flags, 2);
+                ctx.conflicts = pairs;
+                ctx.num_conflicts = 1;
+                printf("bitset: any %d, all %d, none %d, %d conflicting pairs\n", Kirb_flags_any(flag_bits, both, 2),
+                       Kirb_flags_all(flag_bits, both, 2), Kirb_flags_none(flag_bits, both, 2),
+                       Kirb_flags_conflicts(flag_bits, &ctx, NULL));
+                ctx.conflicts = bad_pairs;
+                if(Kirb_flags_conflicts(flag_bits, &ctx, NULL) != -1)
+                {
+                    printf("FAILED: conflicts took a pair naming a flag that doesn't exist\n");
+                    failed = 1;
+                }
+                ctx.conflicts = NULL;
+                ctx.num_conflicts = 0;
+                if(res == 0 && (int) (flag_bits[0] & 1) != flags_results[0])
+                {
+                    printf("FAILED: bitset disagrees with the context parse\n");
+                    failed = 1;
+                }
+                Kirb_free_anon(&ctx, bits_anon);
+            }
+
+            // Test multiple values, -o given twice on a fixed command line
+            char *multi_argv[] = { argv[0], "-o", "a.c", "notes.txt", "--output", "b.c" };
+            int max_values[1] = { 4 }, multi_offsets[2], multi_indices[4], multi_flags[2], multi_num_anon;
+            char **multi_anon = NULL;
+            if(Kirb_parse_multi(6, multi_argv, &ctx, max_values, NULL, multi_flags, multi_offsets, multi_indices,
+                                &multi_num_anon, &multi_anon) == 0)
+            {
+                for(int i = multi_offsets[0]; i < multi_offsets[1]; ++i)
+                    printf("multi value for %c: %s\n", values[0], multi_argv[multi_indices[i]]);
+                Kirb_free_anon(&ctx, multi_anon);
+            }
+            else
+            {
+                printf("FAILED: multi value parse of a fixed command line\n");
+                failed = 1;
+            }
+
+            // Then two values per use, so notes.txt is a value and only extra.txt is left over
+            char *use_argv[] = { argv[0], "-o", "a.c", "notes.txt", "extra.txt", "--output", "b.c", "-v" };
+            int per_use[1] = { 2 };
+            multi_anon = NULL;
+            if(Kirb_parse_multi(8, use_argv, &ctx, max_values, per_use, multi_flags, multi_offsets, multi_indices,
+                                &multi_num_anon, &multi_anon) != 0 || multi_offsets[1] != 3 ||
+               multi_indices[1] != 3 || multi_num_anon != 1 || strcmp(multi_anon[0], "extra.txt") != 0)
+            {
+                printf("FAILED: multi value parse with two values per use\n");
+                failed = 1;
+            }
+            Kirb_free_anon(&ctx, multi_anon);
+
+            // Test typed values, -o read as a size, then with a unit that isn't one
+            KirbType typed_types[1] = { { KIRB_SIZE, NULL, 0 } };
+            KirbTyped typed[1];
+            char *typed_argv[] = { argv[0], "-o", "64K" }, **typed_anon = NULL;
+            int typed_flags[2], typed_num_anon;
+            if(Kirb_parse_typed(3, typed_argv, &ctx, typed_types, typed_flags, typed, &typed_num_anon,
+                                &typed_anon) == 0 && typed[0].as.u == 65536)
+                Kirb_free_anon(&ctx, typed_anon);
+            else
+            {
+                printf("FAILED: typed parse of a fixed command line\n");
+                failed = 1;
+            }
+            typed_argv[2] = "64Q";
+            typed_anon = NULL;
+            if(Kirb_parse_typed(3, typed_argv, &ctx, typed_types, typed_flags, typed, &typed_num_anon,
+                                &typed_anon) != 1 || typed[0].status != KIRB_VALUE_UNIT)
+            {
+                printf("FAILED: typed parse accepted a bad unit\n");
+                failed = 1;
+            }
+
+            // Too many digits for the exact path, so strtod reads it, with a ',' locale where there is one
+            KirbType double_type = { KIRB_DOUBLE, NULL, 0 };
+            KirbTyped pi;
+            char *numeric = setlocale(LC_NUMERIC, "de_DE.UTF-8");
+            if(Kirb_convert("3.14159265358979323846264338327950288", &double_type, &pi) != KIRB_VALUE_OK ||
+               pi.as.d != 3.141592653589793)
+            {
+                printf("FAILED: long double value in the %s locale\n", numeric != NULL ? numeric : "C");
+                failed = 1;
+            }
+            setlocale(LC_NUMERIC, "C");
+
+            // Test subcommands, the global -v then build's own -r
+            char build_flags[] = "r", *build_flags_long[] = { "release" };
+            KirbCommand build = { "build", 1, build_flags, build_flags_long, 0, NULL, NULL, 0 };
+            KirbCommands *commands = Kirb_commands_create(&ctx, &build, 1);
+            char *command_argv[] = { argv[0], "-v", "build", "-r", "main.c" }, *global_values[1], **command_anon = NULL;
+            int global_flags[2], command, next, release, command_num_anon;
+            if(Kirb_parse_global(5, command_argv, commands, global_flags, global_values, &command, &next) == 0 &&
+               command == 0 && global_flags[0] == 1 &&
+               Kirb_parse_command(5, command_argv, commands, command, next, &release, NULL, &command_num_anon,
+                                  &command_anon) == 0 && release == 1 && command_num_anon == 1)
+                Kirb_free_anon(&ctx, command_anon);
+            else
+            {
+                printf("FAILED: subcommand parse of a fixed command line\n");
+                failed = 1;
+            }
+            Kirb_commands_free(commands);
+
+            // Test the rules KirbGen precompiled at build time, which should parse the same as the context's
+            KirbContext loaded;
+            int loaded_flags[2];
+            char *loaded_values[1], **loaded_anon = NULL;
+            if(Kirb_context_load(&loaded, file, stderr, test_rules, sizeof(test_rules), 0) == 0 &&
+               Kirb_parse_all_ctx(argc, argv, &loaded, loaded_flags, loaded_values, &num_anon, &loaded_anon) == res)
+            {
+                if(res == 0 && (loaded_flags[0] != flags_results[0] || loaded_flags[1] != flags_results[1] ||
+                                loaded_values[0] != values_results[0]))
+                {
+                    printf("FAILED: precompiled rules disagree with the context parse\n");
+                    failed = 1;
+                }
+                Kirb_free_anon(&loaded, loaded_anon);
+                Kirb_context_free(&loaded);
+            }
+            else
+            {
+                printf("FAILED: precompiled rules didn't load\n");
+                failed = 1;
+            }
+
+            // Test completion: a long prefix, then a lone dash which lists every option
+            char complete_program[] = "program", complete_prefix[] = "--v", complete_dash[] = "-";
+            char *complete_words[] = { complete_program, complete_prefix };
+            char completions[64];
+            int num_matches;
+            if(Kirb_complete(2, complete_words, &ctx, NULL, completions, sizeof(completions), &num_matches, NULL, NULL) != 0 ||
+               num_matches != 1 || strcmp(completions, "--verbose\n") != 0)
+            {
+                printf("FAILED: completion of --v\n");
+                failed = 1;
+            }
+            complete_words[1] = complete_dash;
+            if(Kirb_complete(2, complete_words, &ctx, NULL, completions, sizeof(completions), &num_matches, NULL, NULL) != 0 ||
+               num_matches != 6)
+            {
+                printf("FAILED: completion of -\n");
+                failed = 1;
+            }
+
+            // Completion scripts for a program path with a space, a quote and a command substitution in it, which
+            //  must come out as one quoted word
+            FILE *script = tmpfile();
+            if(script != NULL)
+            {
+                const char *shells[2] = { "bash", "fish" };
+                const char *quoted_program[2] = { "'/tmp/kirb dir/it'\\''s$(date)/prog' __complete",
+                                                  "'/tmp/kirb dir/it\\'s$(date)/prog' __complete" };
+                for(int sh = 0; sh < 2; ++sh)
+                {
+                    char text[1024];
+                    rewind(script);
+                    if(Kirb_completion_script(script, shells[sh], "/tmp/kirb dir/it's$(date)/prog") != 0)
+                        text[0] = '\0';
+                    else
+                    {
+                        long length = ftell(script);
+                        rewind(script);
+                        text[fread(text, 1, length > 0 && length < (long) sizeof(text) ? (size_t) length : 0,
+                                   script)] = '\0';
+                    }
+                    if(strstr(text, quoted_program[sh]) == NULL)
+                    {
+                        printf("FAILED: %s completion script doesn't quote the program path\n", shells[sh]);
+                        failed = 1;
+                    }
+                }
+                fclose(script);
+            }
+
+            // Test layering: defaults under the command line, which should only fill in what it didn't set
+            int default_flags[2] = { 1, 1 }, layered_flags[2], flag_origins[2], value_origins[1];
+            char *default_values[1] = { "default" }, *layered_values[1], **layered_anon = NULL;
+            KirbLayers *layers = Kirb_layers_create(&ctx, default_flags, default_values, NULL, NULL, 1);
+            if(layers != NULL && Kirb_parse_layered(argc, argv, layers, layered_flags, layered_values, flag_origins,
+                                                    value_origins, &num_anon, &layered_anon) == res)
+            {
+                for(int i = 0; i < 2 && res == 0; ++i)
+                {
+                    if(layered_flags[i] != 1 ||
+                       flag_origins[i] != (flags_results[i] ? KIRB_ORIGIN_ARGV : KIRB_ORIGIN_DEFAULT))
+                    {
+                        printf("FAILED: layered flag %d\n", i);
+                        failed = 1;
+                    }
+                }
+                if(res == 0 && (values_results[0] != NULL ? layered_values[0] != values_results[0] ||
+                                value_origins[0] != KIRB_ORIGIN_ARGV : value_origins[0] != KIRB_ORIGIN_DEFAULT))
+                {
+                    printf("FAILED: layered value\n");
+                    failed = 1;
+                }
+                Kirb_free_anon(&ctx, layered_anon);
+            }
+            else
+            {
+                printf("FAILED: layered parse disagrees with the context parse\n");
+                failed = 1;
+            }
+            Kirb_layers_free(layers);
+
+            // Test streaming, one argument at a time
+            int stream_flags[2], streamed = 0;
+            char *stream_values[1];
+            KirbStream *stream = Kirb_stream_open(&ctx, stream_flags, stream_values, stream_anon, &streamed);
+            if(stream != NULL)
+            {
+                for(int i = 0; i < argc; ++i)
+                    Kirb_stream_push(stream, 1, argv + i);
+                if(Kirb_stream_end(stream) != (res != 0) || (res == 0 && streamed != num_anon))
+                {
+                    printf("FAILED: stream disagrees with the context parse\n");
+                    failed = 1;
+                }
+                Kirb_stream_close(stream);
+            }
+
+            // Test batches, every item is the same command line so every result should match the one above
+            KirbBatchItem items[64];
+            int batch_flags[64 * 2], batch_num_anon[64], batch_rets[64], matches = 0;
+            char *batch_values[64 * 1], **batch_anon[64];
+            for(int i = 0; i < 64; ++i)
+            {
+                items[i].argc = argc;
+                items[i].argv = argv;
+            }
+            ctx.debug = 0;
+            if(Kirb_parse_batch(64, items, &ctx, 4, batch_flags, batch_values, batch_num_anon, batch_anon,
+                                batch_rets) == 0)
+            {
+                for(int i = 0; i < 64; ++i)
+                {
+                    if(batch_rets[i] == res && (res != 0 || (batch_flags[i * 2] == flags_results[0] &&
+                                                             batch_flags[i * 2 + 1] == flags_results[1] &&
+                                                             batch_values[i] == values_results[0] &&
+                                                             batch_num_anon[i] == num_anon)))
+                        ++matches;
+                    if(batch_rets[i] == 0)
+                        Kirb_free_anon(&ctx, batch_anon[i]);
+                }
+                printf("batch items matching the context parse: %d/64\n", matches);
+            }
+
+            // Test arenas, nothing may be allocated while parsing into one, through the hook or (where the test is
+            //  linked with the malloc wrappers) around it
+            char arena[512];
+            KirbResult result;
+            int allocations = 0;
+            ctx.alloc = count_alloc;
+            ctx.release = count_release;
+            ctx.alloc_user = &allocations;
+#if defined(KIRB_WRAP_MALLOC)
+            real_allocations = 0;
+            count_real = 1;
+            res = Kirb_parse_arena(argc, argv, &ctx, arena, sizeof(arena), &result);
+            count_real = 0;
+            allocations += real_allocations;
+#else
+            res = Kirb_parse_arena(argc, argv, &ctx, arena, sizeof(arena), &result);
+#endif
+            if(res == 0)
+            {
+                for(int i = 0; i < 2; ++i)
+                    printf("arena flag bool for %c: %d\n", flags[i], result.flags[i]);
+                for(int i = 0; i < 1; ++i)
+                    printf("arena value for %c: %s\n", values[i], result.values[i]);
+                for(int i = 0; i < result.num_anon; ++i)
+                    printf("arena anon value %s found\n", result.anon[i]);
+            }
+            else if(res == -2)
+                printf("arena too small for %d arguments\n", argc);
+            if(allocations != 0)
+            {
+                printf("FAILED: arena parse allocated %d times\n", allocations);
+                failed = 1;
+            }
+            if(Kirb_arena_size(argc, NULL) != 0 || Kirb_arena_size(0, &ctx) != 0)
+            {
+                printf("FAILED: arena size given for a missing context or no arguments\n");
+                failed = 1;
+            }
+
+            // Test stats and traces, the debug messages should wait in the trace until it's drained
+            KirbStats stats = { 0 };
+            ctx.alloc = NULL;
+            ctx.release = NULL;
+            ctx.stats = &stats;
+            KirbTrace *huge = Kirb_trace_create(SIZE_MAX);
+            if(huge != NULL)
+            {
+                printf("FAILED: trace created with a capacity past the largest power of two\n");
+                Kirb_trace_free(huge);
+                failed = 1;
+            }
+            ctx.trace = Kirb_trace_create(64);
+            ctx.debug = 1;
+            anon = NULL;
+            res = Kirb_parse_all_ctx(argc, argv, &ctx, flags_results, values_results, &num_anon, &anon);
+            if(res == 0)
+                Kirb_free_anon(&ctx, anon);
+            printf("stats: %d visits, %d short, %d long, %d values, %d anonymous, %d duplicates, %d crossovers\n",
+                   (int) stats.visits, (int) stats.shorts, (int) stats.longs, (int) stats.values,
+                   (int) stats.anonymous, (int) stats.duplicates, (int) stats.crossovers);
+            if(stats.visits != (uint64_t) argc)
+            {
+                printf("FAILED: parse visited %d of %d arguments\n", (int) stats.visits, argc);
+                failed = 1;
+            }
+            printf("trace messages: %d\n", (int) Kirb_trace_drain(ctx.trace, file));
+            Kirb_trace_free(ctx.trace);
+            Kirb_context_free(&ctx);
         }
     }
 
     fclose(file);
-    free(anon_results);
-    return 0;
+    return failed;
 }
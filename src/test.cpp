@@ -0,0 +1,112 @@
+// Test file for kirbparse.hpp, checking the compile-time schema against the C library's context parse
+
+#include "kirbparse.h"
+#include "kirbparse.hpp"
+#include <cstdio>
+#include <vector>
+
+namespace
+{
+    // The same rules as test.c, flags first so option i is flag i or value option i - 2
+    constexpr kirb::Option options[] = {
+        kirb::flag('v', "verbose"), kirb::flag('h', "help"), kirb::value('o', "output")
+    };
+    constexpr kirb::Schema schema(options);
+    constexpr kirb::Schema strict(options, false, true);
+    constexpr kirb::Schema crossover(options, true);
+
+    // Every lookup is settled by the compiler
+    static_assert(schema.find("verbose") == 0);
+    static_assert(schema.find("help") == 1);
+    static_assert(schema.find("output") == 2);
+    static_assert(schema.find("outpu") == 3 && schema.find("") == 3 && schema.find("verbose2") == 3);
+
+    // Command lines that take the parse through each of its outcomes
+    const std::vector<std::vector<const char*>> command_lines = {
+        { "prog" },
+        { "prog", "-v", "--help", "anon" },
+        { "prog", "-o", "file", "-v", "x", "y" },
+        { "prog", "--output", "file", "--verbose" },
+        { "prog", "-v", "--verbose" },               // Crossover
+        { "prog", "-v", "-v" },                      // Duplicate flag, only an error under werror
+        { "prog", "-o", "a", "-o", "b" },            // Duplicate value option
+        { "prog", "-o" },                            // Missing value
+        { "prog", "-o", "-v", "file" },
+        { "prog", "--", "-v", "x" },
+        { "prog", "-", "--verb", "-vh", "---" },
+        { "prog", "--output=file", "x" },
+    };
+
+    // Kirb_parse_all_ctx and schema.parse on argv, 0 if they agree
+    template <std::size_t N>
+    int compare(const kirb::Schema<N> &schema, KirbContext *ctx, std::vector<const char*> args)
+    {
+        char **argv = const_cast<char**>(args.data());
+        int argc = static_cast<int>(args.size());
+        int flags[2];
+        char *values[1];
+        int num_anon = 0;
+        char **anon = nullptr;
+        int expected = Kirb_parse_all_ctx(argc, argv, ctx, flags, values, &num_anon, &anon);
+        kirb::Result<N> result = schema.parse(argc, argv);
+
+        bool agree = result.status == expected;
+        if(agree && expected == 0)
+        {
+            for(std::size_t i = 0; i < 2; ++i)
+                agree &= result.flag(i) == (flags[i] != 0);
+            agree &= result.value(2).data() == values[0];
+            agree &= result.anonymous.size() == static_cast<std::size_t>(num_anon);
+            for(std::size_t i = 0; agree && i < result.anonymous.size(); ++i)
+                agree &= result.anonymous[i].data() == anon[i];
+        }
+        if(expected == 0)
+            Kirb_free_anon(ctx, anon);
+
+        if(!agree)
+        {
+            std::printf("FAILED: schema parse returned %d, context parse %d, for", result.status, expected);
+            for(const char *arg : args)
+                std::printf(" \"%s\"", arg);
+            std::printf("\n");
+        }
+        return !agree;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    char flags[3] = "vh";
+    char value_opts[2] = "o";
+    char verbose[] = "verbose", help[] = "help", output[] = "output";
+    char *flags_long[2] = { verbose, help };
+    char *value_opts_long[1] = { output };
+
+    int failed = 0;
+    KirbContext ctx;
+    for(int mode = 0; mode < 3; ++mode)
+    {
+        if(Kirb_context_init(&ctx, stdout, stdout, 2, flags, flags_long, 1, value_opts, value_opts_long, 0,
+                             mode == 2) != 0)
+        {
+            std::printf("FAILED: context init\n");
+            return 1;
+        }
+        ctx.werror = mode == 1;
+        std::vector<std::vector<const char*>> lines = command_lines;
+        lines.emplace_back(argv, argv + argc);
+        for(const auto &line : lines)
+        {
+            if(mode == 0)
+                failed |= compare(schema, &ctx, line);
+            else if(mode == 1)
+                failed |= compare(strict, &ctx, line);
+            else
+                failed |= compare(crossover, &ctx, line);
+        }
+        Kirb_context_free(&ctx);
+    }
+
+    std::printf(failed ? "schema parses disagree\n" : "schema parses agree\n");
+    return failed;
+}